@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for data that lives exactly as long as one page. Blocks are
+// kept across reset(), so a worker that reuses its arena stops allocating once
+// it has seen its largest page.
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 16 * 1024) : blockSize(blockSize) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (current < blocks.size() && offset + size <= blocks[current].size)
+        {
+            used = offset + size;
+            return blocks[current].data.get() + offset;
+        }
+        return allocateSlow(size, align);
+    }
+
+    // Copies a string into the arena and returns a view of the copy
+    std::string_view copy(std::string_view s)
+    {
+        char *out = static_cast<char *>(allocate(s.size() + 1, 1));
+        memcpy(out, s.data(), s.size());
+        out[s.size()] = '\0';
+        return std::string_view(out, s.size());
+    }
+
+    // Releases everything handed out since the last reset in O(1)
+    void reset()
+    {
+        current = 0;
+        used = 0;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void *allocateSlow(size_t size, size_t align)
+    {
+        // Move on to the next retained block that fits, or add one
+        while (++current < blocks.size())
+        {
+            if (size + align <= blocks[current].size)
+                break;
+        }
+        if (current >= blocks.size())
+        {
+            size_t bytes = std::max(blockSize, size + align);
+            blocks.push_back({std::unique_ptr<char[]>(new char[bytes]), bytes});
+            current = blocks.size() - 1;
+        }
+        used = 0;
+        return allocate(size, align);
+    }
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+};
+
+// Vector of trivially copyable records with the first N stored inline.
+// clear() keeps any heap capacity, like std::vector.
+template <typename T, size_t N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVector only holds trivially copyable records");
+
+public:
+    SmallVector() = default;
+    SmallVector(const SmallVector &) = delete;
+    SmallVector &operator=(const SmallVector &) = delete;
+    ~SmallVector()
+    {
+        if (items != inlineItems)
+            free(items);
+    }
+
+    void push_back(const T &item)
+    {
+        if (count == capacity)
+            grow();
+        items[count++] = item;
+    }
+
+    void clear() { count = 0; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items; }
+    T *end() { return items + count; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+
+private:
+    void grow()
+    {
+        size_t newCapacity = capacity * 2;
+        T *grown = static_cast<T *>(malloc(newCapacity * sizeof(T)));
+        if (!grown)
+            throw std::bad_alloc();
+        memcpy(static_cast<void *>(grown), items, count * sizeof(T));
+        if (items != inlineItems)
+            free(items);
+        items = grown;
+        capacity = newCapacity;
+    }
+
+    T inlineItems[N];
+    T *items = inlineItems;
+    size_t count = 0;
+    size_t capacity = N;
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <curl/curl.h>
+#include "resolve.h"
+#include "url_parse.h"
+
+// Rewrites URLs into one spelling per resource so the visited check does not
+// fetch the same page under several names.
+//
+// canonicalize() only makes changes that cannot alter what a server sees:
+// case, escapes, dot segments, default ports, the fragment. Sorting the query
+// and dropping tracking parameters could, so visitKey() applies those to the
+// key the visited check goes by, and the URL fetched keeps its parameters as
+// the page linked them.
+struct CanonOptions
+{
+    // For the visited key only, like dropParams
+    bool sortQuery = true;
+    bool dropFragment = true;
+    // Query parameters removed entirely; a trailing '*' matches a prefix
+    std::vector<std::string> dropParams = {"utm_*", "gclid", "fbclid"};
+};
+
+inline char asciiLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = asciiLower(c);
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+inline bool isUnreserved(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.' ||
+           c == '_' || c == '~';
+}
+
+// Characters that may appear literally in a path or query besides the
+// unreserved ones: sub-delims, ':', '@', '/', and '?' in the query.
+inline bool isAllowedLiteral(unsigned char c, bool query)
+{
+    switch (c)
+    {
+    case '!':
+    case '$':
+    case '&':
+    case '\'':
+    case '(':
+    case ')':
+    case '*':
+    case '+':
+    case ',':
+    case ';':
+    case '=':
+    case ':':
+    case '@':
+    case '/':
+        return true;
+    case '?':
+        return query;
+    default:
+        return false;
+    }
+}
+
+// Decodes escapes of unreserved characters, upper-cases the hex digits of the
+// rest and escapes bytes that may not appear literally.
+inline void appendNormalizedEscapes(std::string &out, std::string_view part, bool query)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < part.size(); i++)
+    {
+        // Copy runs that need no rewriting in one go
+        size_t run = i;
+        while (run < part.size() && (isUnreserved(part[run]) || isAllowedLiteral(part[run], query)))
+            run++;
+        if (run > i)
+        {
+            out.append(part.data() + i, run - i);
+            i = run;
+            if (i == part.size())
+                break;
+        }
+
+        unsigned char c = part[i];
+        if (c == '%' && i + 2 < part.size() && hexValue(part[i + 1]) >= 0 && hexValue(part[i + 2]) >= 0)
+        {
+            unsigned char decoded = hexValue(part[i + 1]) * 16 + hexValue(part[i + 2]);
+            if (isUnreserved(decoded))
+                out += static_cast<char>(decoded);
+            else
+            {
+                out += '%';
+                out += hex[decoded >> 4];
+                out += hex[decoded & 15];
+            }
+            i += 2;
+        }
+        else if (isUnreserved(c) || isAllowedLiteral(c, query) || c == '%')
+            out += static_cast<char>(c);
+        else
+        {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+}
+
+inline bool matchesParam(std::string_view name, const std::vector<std::string> &patterns)
+{
+    for (const auto &pattern : patterns)
+    {
+        if (!pattern.empty() && pattern.back() == '*')
+        {
+            if (name.substr(0, pattern.size() - 1) == std::string_view(pattern).substr(0, pattern.size() - 1))
+                return true;
+        }
+        else if (name == pattern)
+            return true;
+    }
+    return false;
+}
+
+// Internationalized host names go through libcurl's IDNA support; everything
+// else is handled inline.
+inline bool punycodeHost(const std::string &host, std::string &out)
+{
+    CURLU *url = curl_url();
+    if (!url)
+        return false;
+    bool ok = false;
+    std::string probe = "http://" + host + "/";
+    char *ascii = nullptr;
+    if (curl_url_set(url, CURLUPART_URL, probe.c_str(), 0) == CURLUE_OK &&
+        curl_url_get(url, CURLUPART_HOST, &ascii, CURLU_PUNYCODE) == CURLUE_OK)
+    {
+        out = ascii;
+        for (auto &c : out)
+            c = asciiLower(c);
+        ok = true;
+    }
+    curl_free(ascii);
+    curl_url_cleanup(url);
+    return ok;
+}
+
+// Writes the canonical form of url, already split by parseUrl(), into out
+inline void canonicalize(std::string_view url, const UrlComponents &parts, std::string &out, const CanonOptions &options)
+{
+    out.clear();
+    for (char c : parts.scheme(url))
+        out += asciiLower(c);
+    out += "://";
+    out.append(parts.userinfo(url));
+
+    std::string_view host = parts.host(url);
+    std::string_view port = parts.port(url);
+    while (!host.empty() && host.back() == '.')
+        host.remove_suffix(1);
+
+    bool needsIdna = false;
+    for (char c : host)
+        needsIdna |= static_cast<unsigned char>(c) >= 0x80 || c == '%';
+    std::string asciiHost;
+    if (needsIdna && punycodeHost(std::string(host), asciiHost))
+        out += asciiHost;
+    else
+    {
+        for (char c : host)
+            out += asciiLower(c);
+    }
+
+    while (port.size() > 1 && port.front() == '0')
+        port.remove_prefix(1);
+    bool defaultPort = port.empty() || (port == "80" && (out.compare(0, 5, "http:") == 0 || out.compare(0, 3, "ws:") == 0)) ||
+                       (port == "443" && (out.compare(0, 6, "https:") == 0 || out.compare(0, 4, "wss:") == 0)) ||
+                       (port == "21" && out.compare(0, 4, "ftp:") == 0);
+    if (!defaultPort)
+    {
+        out += ':';
+        out.append(port);
+    }
+
+    std::string_view path = parts.path(url);
+    std::string_view query = parts.query(url);
+    std::string_view fragment = parts.fragment(url);
+
+    size_t pathStart = out.size();
+    if (path.empty())
+        out += '/';
+    else
+    {
+        appendNormalizedEscapes(out, path, false);
+        if (out.find("/.", pathStart) != std::string::npos)
+            out.resize(pathStart + removeDotSegments(&out[pathStart], out.size() - pathStart));
+    }
+
+    if (!query.empty())
+    {
+        out += '?';
+        appendNormalizedEscapes(out, query, true);
+    }
+
+    if (!options.dropFragment && !fragment.empty())
+    {
+        out += '#';
+        appendNormalizedEscapes(out, fragment, true);
+    }
+}
+
+// Writes the visited key of a canonical URL, split by parseUrl(), into out:
+// its query without the dropped parameters and, with sortQuery, in order.
+// Returns false, leaving out alone, when the key is the URL itself.
+inline bool visitKey(std::string_view url, const UrlComponents &parts, std::string &out, const CanonOptions &options)
+{
+    std::string_view query = parts.query(url);
+    if (query.empty())
+        return false;
+    // Reused between calls; this runs on every extracted link with a query
+    thread_local std::vector<std::string_view> params;
+    params.clear();
+    bool changed = false;
+    size_t start = 0;
+    while (start <= query.size())
+    {
+        size_t amp = query.find('&', start);
+        if (amp == std::string_view::npos)
+            amp = query.size();
+        std::string_view param = query.substr(start, amp - start);
+        if (!param.empty() && !matchesParam(param.substr(0, param.find('=')), options.dropParams))
+            params.push_back(param);
+        else
+            changed = true;
+        start = amp + 1;
+    }
+    // Insertion sort: stable, allocation free, and queries are short
+    if (options.sortQuery)
+    {
+        for (size_t i = 1; i < params.size(); i++)
+        {
+            std::string_view param = params[i];
+            size_t j = i;
+            for (; j > 0 && param < params[j - 1]; j--)
+                params[j] = params[j - 1];
+            params[j] = param;
+            changed |= j != i;
+        }
+    }
+    if (!changed)
+        return false;
+
+    // The query starts after its '?', and anything after it is the fragment
+    out.assign(url.substr(0, query.data() - url.data() - 1));
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        out += i == 0 ? '?' : '&';
+        out.append(params[i]);
+    }
+    out.append(url.substr(query.data() + query.size() - url.data()));
+    return true;
+}
+
+// Writes the canonical form of an absolute URL into out. Returns false when
+// parseUrl() rejects it, in which case out holds it unchanged.
+inline bool canonicalize(std::string_view url, std::string &out, const CanonOptions &options)
+{
+    UrlComponents parts;
+    if (!parseUrl(url, parts))
+    {
+        out.assign(url);
+        return false;
+    }
+    canonicalize(url, parts, out, options);
+    return true;
+}
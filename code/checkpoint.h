@@ -0,0 +1,382 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "url_table.h"
+
+// Progress of a crawl kept on disk, so a crawl that dies can be picked up
+// where it stood. A checkpoint is incremental: it appends what changed since
+// the last one, so its cost follows the crawl's pace rather than its size.
+//
+// Three append-only files grow with the crawl:
+//
+//   - urls: every interned URL in ID order, length first, so replaying them
+//     into an empty UrlTable gives each its old ID back;
+//   - tasks: every task the frontier queued as new;
+//   - completed: the keys of tasks whose work is done.
+//
+// A small state file records how much of each is valid, plus a blob of the
+// caller's own state that is rewritten in full every time. It is written
+// beside the old one, synced and renamed over it, so a crash at any point
+// leaves the previous checkpoint whole; bytes appended past the recorded
+// lengths are cut off before the next append.
+//
+// Tasks are written as bytes, so they must be trivially copyable. Not
+// synchronised; one thread writes checkpoints.
+template <typename Task>
+class Checkpoint
+{
+    static_assert(std::is_trivially_copyable<Task>::value, "tasks are written to disk as bytes");
+
+public:
+    // What one checkpoint adds; write() empties the vectors
+    struct Delta
+    {
+        std::vector<Task> tasks;
+        std::vector<UrlId> completed;
+        // URLs interned when the tasks were cut, so every ID they use is lower
+        size_t urlCount = 0;
+        std::string state;
+    };
+
+    // Files live in folder, which is created on the first write
+    explicit Checkpoint(std::string folder) : folder(std::move(folder)) { found = readState(); }
+
+    // True if folder held a checkpoint when this was constructed
+    bool exists() const { return found; }
+
+    // Appends delta to the files and makes it the latest checkpoint. On
+    // failure the previous one stays valid, and delta's tasks and keys are
+    // carried over to the next attempt.
+    bool write(const UrlTable &urls, Delta &delta)
+    {
+        auto start = std::chrono::steady_clock::now();
+        carriedTasks.insert(carriedTasks.end(), delta.tasks.begin(), delta.tasks.end());
+        carriedCompleted.insert(carriedCompleted.end(), delta.completed.begin(), delta.completed.end());
+        delta.tasks.clear();
+        delta.completed.clear();
+
+        std::error_code error;
+        std::filesystem::create_directories(folder, error);
+        Appender urlFile(folder + "/urls", header.urlBytes);
+        std::string buffer;
+        size_t urlCount = std::max<size_t>(delta.urlCount, header.urlCount);
+        for (size_t id = header.urlCount; id < urlCount && urlFile.ok; id++)
+        {
+            std::string_view url = urls.get(static_cast<UrlId>(id));
+            uint32_t size = static_cast<uint32_t>(url.size());
+            buffer.append(reinterpret_cast<const char *>(&size), sizeof(size));
+            buffer.append(url);
+            if (buffer.size() >= bufferBytes)
+            {
+                urlFile.append(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        urlFile.append(buffer.data(), buffer.size());
+        Appender taskFile(folder + "/tasks", header.taskCount * sizeof(Task));
+        taskFile.append(carriedTasks.data(), carriedTasks.size() * sizeof(Task));
+        Appender completedFile(folder + "/completed", header.completedCount * sizeof(UrlId));
+        completedFile.append(carriedCompleted.data(), carriedCompleted.size() * sizeof(UrlId));
+
+        Header next = header;
+        next.urlCount = urlCount;
+        next.urlBytes = urlFile.offset;
+        next.taskCount += carriedTasks.size();
+        next.completedCount += carriedCompleted.size();
+        next.stateBytes = delta.state.size();
+        bool synced = urlFile.finish() & taskFile.finish() & completedFile.finish();
+        if (!synced || !writeState(next, delta.state))
+        {
+            std::cerr << "Could not write checkpoint " << folder << "\n";
+            failures++;
+            return false;
+        }
+        bytesWritten += (next.urlBytes - header.urlBytes) + carriedTasks.size() * sizeof(Task) +
+                        carriedCompleted.size() * sizeof(UrlId) + delta.state.size();
+        header = next;
+        carriedTasks.clear();
+        carriedCompleted.clear();
+        found = true;
+        written++;
+        lastTime = std::chrono::steady_clock::now() - start;
+        return true;
+    }
+
+    // Replays the latest checkpoint: url(view) for every URL in ID order,
+    // returning false to give up, then completed(key) for every completed key,
+    // then task(task) for every task, in the order they were queued. Sets
+    // state to the caller's blob. Returns false if the files could not be read.
+    template <typename OnUrl, typename OnCompleted, typename OnTask>
+    bool load(OnUrl url, OnCompleted completed, OnTask task, std::string &state)
+    {
+        if (!found)
+            return false;
+        state = savedState;
+
+        std::ifstream file(folder + "/urls", std::ios::binary);
+        std::string text;
+        for (size_t id = 0; id < header.urlCount; id++)
+        {
+            uint32_t size = 0;
+            if (!file.read(reinterpret_cast<char *>(&size), sizeof(size)))
+                return fail("urls");
+            text.resize(size);
+            if (!file.read(text.data(), size) || !url(std::string_view(text)))
+                return fail("urls");
+        }
+
+        if (!readRecords<UrlId>("completed", header.completedCount, completed))
+            return false;
+        return readRecords<Task>("tasks", header.taskCount, task);
+    }
+
+    // Deletes the checkpoint, once the crawl it belongs to is over
+    void remove()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+        header = Header();
+        found = false;
+    }
+
+    size_t urlCount() const { return header.urlCount; }
+    size_t taskCount() const { return header.taskCount; }
+    size_t completedCount() const { return header.completedCount; }
+
+    void report(std::ostream &out) const
+    {
+        out << "checkpoint: " << written << " written";
+        if (written)
+            out << ", last in " << std::chrono::duration_cast<std::chrono::milliseconds>(lastTime).count() << " ms";
+        if (failures)
+            out << ", " << failures << " failed";
+        out << "; " << header.urlCount << " urls, " << header.taskCount << " tasks, " << header.completedCount
+            << " completed, " << (header.urlBytes + header.taskCount * sizeof(Task) + header.completedCount * sizeof(UrlId)) / (1024 * 1024)
+            << " MiB on disk, " << bytesWritten / (1024 * 1024) << " MiB written this run\n";
+    }
+
+private:
+    static constexpr uint64_t magic = 0x3174706b63637777; // "wwcckpt1"
+    static constexpr size_t bufferBytes = size_t(1) << 20;
+
+    struct Header
+    {
+        uint64_t magic = Checkpoint::magic;
+        uint64_t taskSize = sizeof(Task);
+        uint64_t urlCount = 0;
+        uint64_t urlBytes = 0;
+        uint64_t taskCount = 0;
+        uint64_t completedCount = 0;
+        uint64_t stateBytes = 0;
+    };
+
+    // Appends to a file from offset on, cutting off anything past it first
+    struct Appender
+    {
+        Appender(const std::string &filename, uint64_t offset) : offset(offset)
+        {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            ok = fd >= 0 && ftruncate(fd, offset) == 0;
+        }
+
+        void append(const void *data, size_t bytes)
+        {
+            const char *next = static_cast<const char *>(data);
+            while (ok && bytes > 0)
+            {
+                ssize_t written = pwrite(fd, next, bytes, offset);
+                if (written <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                next += written;
+                bytes -= written;
+                offset += written;
+            }
+        }
+
+        // Syncs and closes the file. Returns false if anything failed.
+        bool finish()
+        {
+            if (fd < 0)
+                return false;
+            ok = ok && fsync(fd) == 0;
+            close(fd);
+            fd = -1;
+            return ok;
+        }
+
+        ~Appender()
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+
+        int fd;
+        uint64_t offset;
+        bool ok;
+    };
+
+    bool writeState(const Header &next, const std::string &state)
+    {
+        std::string temporary = folder + "/state.tmp";
+        Appender file(temporary, 0);
+        file.append(&next, sizeof(next));
+        file.append(state.data(), state.size());
+        if (!file.finish())
+            return false;
+        std::error_code error;
+        std::filesystem::rename(temporary, folder + "/state", error);
+        if (error)
+            return false;
+        // The rename itself is durable once the folder is synced
+        int directory = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory >= 0)
+        {
+            fsync(directory);
+            close(directory);
+        }
+        savedState = state;
+        return true;
+    }
+
+    bool readState()
+    {
+        int fd = open((folder + "/state").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        Header saved;
+        bool ok = pread(fd, &saved, sizeof(saved), 0) == static_cast<ssize_t>(sizeof(saved)) && saved.magic == magic &&
+                  saved.taskSize == sizeof(Task);
+        if (ok)
+        {
+            savedState.resize(saved.stateBytes);
+            ok = pread(fd, savedState.data(), saved.stateBytes, sizeof(saved)) == static_cast<ssize_t>(saved.stateBytes);
+        }
+        close(fd);
+        if (!ok)
+        {
+            std::cerr << "Ignoring unreadable checkpoint " << folder << "\n";
+            savedState.clear();
+            return false;
+        }
+        header = saved;
+        return true;
+    }
+
+    // Calls each(record) for the first count records of a file
+    template <typename Record, typename Each>
+    bool readRecords(const char *name, size_t count, Each each)
+    {
+        int fd = open((folder + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+        std::vector<Record> chunk;
+        for (size_t done = 0; done < count;)
+        {
+            chunk.resize(std::min(count - done, bufferBytes / sizeof(Record)));
+            size_t bytes = chunk.size() * sizeof(Record);
+            if (fd < 0 || pread(fd, chunk.data(), bytes, done * sizeof(Record)) != static_cast<ssize_t>(bytes))
+            {
+                if (fd >= 0)
+                    close(fd);
+                return fail(name);
+            }
+            for (const auto &record : chunk)
+                each(record);
+            done += chunk.size();
+        }
+        if (fd >= 0)
+            close(fd);
+        return true;
+    }
+
+    bool fail(const char *name)
+    {
+        std::cerr << "Could not read checkpoint " << folder << "/" << name << "\n";
+        return false;
+    }
+
+    std::string folder;
+    Header header;
+    std::string savedState;
+    bool found = false;
+    // Cut by a write that failed, waiting for the next one
+    std::vector<Task> carriedTasks;
+    std::vector<UrlId> carriedCompleted;
+    size_t written = 0;
+    size_t failures = 0;
+    size_t bytesWritten = 0;
+    std::chrono::steady_clock::duration lastTime{0};
+};
+
+// Builds the caller's state blob for a Checkpoint out of trivially copyable
+// values and maps of integers
+struct StateWriter
+{
+    std::string bytes;
+
+    template <typename T>
+    void put(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "values are stored as bytes");
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    // Any container of pairs of integers
+    template <typename Map>
+    void putMap(const Map &map)
+    {
+        put(static_cast<uint64_t>(map.size()));
+        for (const auto &entry : map)
+        {
+            put(static_cast<uint64_t>(entry.first));
+            put(static_cast<int64_t>(entry.second));
+        }
+    }
+};
+
+// Reads back what a StateWriter wrote, in the same order
+struct StateReader
+{
+    std::string_view bytes;
+    bool failed = false;
+
+    template <typename T>
+    T get()
+    {
+        T value{};
+        if (bytes.size() < sizeof(T))
+            failed = true;
+        else
+        {
+            std::memcpy(&value, bytes.data(), sizeof(T));
+            bytes.remove_prefix(sizeof(T));
+        }
+        return value;
+    }
+
+    // Calls each(key, value) for every pair of a putMap()
+    template <typename Each>
+    void getMap(Each each)
+    {
+        uint64_t count = get<uint64_t>();
+        for (uint64_t i = 0; i < count && !failed; i++)
+        {
+            uint64_t key = get<uint64_t>();
+            int64_t value = get<int64_t>();
+            if (!failed)
+                each(key, value);
+        }
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+
+// Scoring policies for the frontier's priority queue. A policy is a type
+// with a static score(task, stats) returning an integer: higher is fetched
+// sooner, equal scores in discovery order. The frontier takes the policy as a
+// template argument, so the score is inlined into push(); pick one with
+// -DCRAWL_PRIORITY=ByInlinks and so on, or write another along the same lines.
+//
+// rescored says the score grows with stats.inlinks. Such a score can rise
+// after a URL was queued, so the frontier queues it again, once each time its
+// inlink count doubles, and skips the older entry when it comes up.
+
+// What the frontier knows about a link when it queues it
+struct LinkStats
+{
+    // Links to the URL seen so far, this one included
+    uint32_t inlinks = 1;
+    // Links into the URL's site seen so far from pages of other sites
+    uint32_t siteInlinks = 0;
+    // Links queued before this one
+    uint64_t sequence = 0;
+};
+
+// Shallowest first: breadth-first order, the crawler's traditional behaviour
+struct ByDepth
+{
+    static constexpr bool rescored = false;
+
+    template <typename Task>
+    static int64_t score(const Task &task, const LinkStats &)
+    {
+        return -task.depth;
+    }
+};
+
+// Most linked-to first, a cheap stand-in for PageRank
+struct ByInlinks
+{
+    static constexpr bool rescored = true;
+
+    template <typename Task>
+    static int64_t score(const Task &task, const LinkStats &stats)
+    {
+        return stats.inlinks;
+    }
+};
+
+// URLs of sites that other sites link to most first
+struct BySiteImportance
+{
+    static constexpr bool rescored = false;
+
+    template <typename Task>
+    static int64_t score(const Task &task, const LinkStats &stats)
+    {
+        return stats.siteInlinks;
+    }
+};
+
+// Latest discoveries first; on news and forum sites the newest links are
+// usually the newest content
+struct ByFreshness
+{
+    static constexpr bool rescored = false;
+
+    template <typename Task>
+    static int64_t score(const Task &, const LinkStats &stats)
+    {
+        return static_cast<int64_t>(stats.sequence);
+    }
+};
+
+// Links near the top of their page first: navigation and lead articles before
+// footers and archives
+struct ByLinkPosition
+{
+    static constexpr bool rescored = false;
+
+    template <typename Task>
+    static int64_t score(const Task &task, const LinkStats &)
+    {
+        return -static_cast<int64_t>(task.position);
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "extract.h"
+
+// Position of the next byte the CSS scanner has to look at: comment starts,
+// string delimiters, the '(' of url( and the '@' of @import. Everything else
+// is skipped 16 bytes at a time.
+inline size_t nextCssSpecial(const char *data, size_t size, size_t pos)
+{
+#ifdef __SSE2__
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i paren = _mm_set1_epi8('(');
+    const __m128i at = _mm_set1_epi8('@');
+    while (pos + 16 <= size)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, slash), _mm_cmpeq_epi8(block, dquote)),
+                                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, squote), _mm_cmpeq_epi8(block, paren)),
+                                                 _mm_cmpeq_epi8(block, at)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+    for (; pos < size; pos++)
+    {
+        char c = data[pos];
+        if (c == '/' || c == '"' || c == '\'' || c == '(' || c == '@')
+            return pos;
+    }
+    return size;
+}
+
+inline bool isCssIdentChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+           static_cast<unsigned char>(c) >= 0x80;
+}
+
+inline size_t skipCssSpace(const char *data, size_t size, size_t pos)
+{
+    while (pos < size && isSpace(data[pos]))
+        pos++;
+    return pos;
+}
+
+// Scans a quoted string starting at its opening quote. Returns the position
+// after the closing quote and stores the contents in value.
+inline size_t scanCssString(const char *data, size_t size, size_t pos, std::string_view &value)
+{
+    char quote = data[pos++];
+    size_t start = pos;
+    while (pos < size && data[pos] != quote && data[pos] != '\n')
+    {
+        if (data[pos] == '\\')
+            pos++;
+        pos++;
+    }
+    value = std::string_view(data + start, std::min(pos, size) - start);
+    return pos < size ? pos + 1 : size;
+}
+
+// Scans the argument of url( starting right after the parenthesis. Returns the
+// position after the closing parenthesis.
+inline size_t scanCssUrl(const char *data, size_t size, size_t pos, std::string_view &value)
+{
+    pos = skipCssSpace(data, size, pos);
+    if (pos < size && (data[pos] == '"' || data[pos] == '\''))
+    {
+        pos = scanCssString(data, size, pos, value);
+        while (pos < size && data[pos] != ')')
+            pos++;
+        return pos < size ? pos + 1 : size;
+    }
+
+    size_t start = pos;
+    while (pos < size && data[pos] != ')')
+    {
+        if (data[pos] == '\\')
+            pos++;
+        pos++;
+    }
+    value = trim(std::string_view(data + start, std::min(pos, size) - start));
+    return pos < size ? pos + 1 : size;
+}
+
+// Fonts are told apart from images by extension; anything else is an image
+inline rtype cssUrlType(std::string_view url)
+{
+    url = url.substr(0, url.find_first_of("?#"));
+    size_t dot = url.rfind('.');
+    if (dot == std::string_view::npos)
+        return IMAGE;
+    std::string_view ext = url.substr(dot + 1);
+    if (asciiIEquals(ext, "woff") || asciiIEquals(ext, "woff2") || asciiIEquals(ext, "ttf") ||
+        asciiIEquals(ext, "otf") || asciiIEquals(ext, "eot"))
+        return FONT;
+    if (asciiIEquals(ext, "css"))
+        return STYLESHEET;
+    return IMAGE;
+}
+
+// Extracts the url(...) and @import targets of a stylesheet in one forward
+// pass, skipping comments and strings. Targets are resolved against the
+// stylesheet's own URL.
+inline void scanCSS(const char *data, size_t size, std::string_view stylesheetURL, PageResources &resources)
+{
+    ExtractContext ctx{resources, stylesheetURL};
+    size_t pos = 0;
+    while ((pos = nextCssSpecial(data, size, pos)) < size)
+    {
+        switch (data[pos])
+        {
+        case '/':
+            if (pos + 1 < size && data[pos + 1] == '*')
+            {
+                const char *end = static_cast<const char *>(memmem(data + pos + 2, size - pos - 2, "*/", 2));
+                pos = end ? end - data + 2 : size;
+            }
+            else
+                pos++;
+            break;
+        case '"':
+        case '\'':
+        {
+            std::string_view ignored;
+            pos = scanCssString(data, size, pos, ignored);
+            break;
+        }
+        case '(':
+        {
+            bool isUrl = pos >= 3 && asciiIEquals(std::string_view(data + pos - 3, 3), "url") &&
+                         (pos == 3 || !isCssIdentChar(data[pos - 4]));
+            if (!isUrl)
+            {
+                pos++;
+                break;
+            }
+            std::string_view url;
+            pos = scanCssUrl(data, size, pos + 1, url);
+            addResource(ctx, url, cssUrlType(url));
+            break;
+        }
+        case '@':
+        {
+            if (size - pos < 7 || !asciiIEquals(std::string_view(data + pos + 1, 6), "import"))
+            {
+                pos++;
+                break;
+            }
+            pos = skipCssSpace(data, size, pos + 7);
+            std::string_view url;
+            if (pos < size && (data[pos] == '"' || data[pos] == '\''))
+                pos = scanCssString(data, size, pos, url);
+            else if (size - pos >= 4 && asciiIEquals(std::string_view(data + pos, 4), "url("))
+                pos = scanCssUrl(data, size, pos + 4, url);
+            addResource(ctx, url, STYLESHEET);
+            break;
+        }
+        }
+    }
+}
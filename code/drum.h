@@ -0,0 +1,436 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Batched check-and-insert of 64-bit keys against a set on disk, after DRUM
+// in IRLbot (Lee et al., "IRLbot: Scaling to 6 Billion Pages and Beyond").
+//
+// add() never touches the stored set. The key, with its arrival number, goes
+// into one of bucketCount buckets by its top bits: first into a small memory
+// buffer, then appended to that bucket's file on disk. The record that came
+// with it is appended to a single file in arrival order. Once a bucket file
+// holds bucketLimit keys, merge() is due. It goes bucket by bucket: the keys
+// are sorted and walked together with the bucket's sorted key file in one
+// sequential pass, which writes the updated key file and marks every arrival
+// new or already known. The record file is then read back, calling
+// release(record, isNew) in arrival order, the first of several equal keys
+// being the new one.
+//
+// Disk traffic is all sequential, and each stored key is read once per merge
+// however many times it is checked. Records are written to disk as bytes, so
+// they must be trivially copyable.
+//
+// A failed write keeps its entries in memory, and the next attempt comes only
+// after a quarter as many again have gathered, doubling up to as many, so a
+// full disk is not retried on every add(). An entry whose key or record cannot
+// be read back is lost: merge() does not release it, but counts it.
+struct DrumOptions
+{
+    size_t bucketCount = 256;
+    // Keys a bucket buffers in memory before appending them to its file;
+    // records are buffered bucketCount times as many
+    size_t bufferEntries = 1024;
+    // Keys in a bucket file that make a merge due
+    size_t bucketLimit = size_t(1) << 18;
+};
+
+template <typename Record>
+class Drum
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "records are written to disk as bytes");
+
+public:
+    // Bucket, key and record files go into folder, which is created and emptied
+    explicit Drum(std::string folder, DrumOptions options = DrumOptions())
+        : folder(std::move(folder)), options(options), buckets(options.bucketCount),
+          recordRetry(options.bufferEntries * options.bucketCount)
+    {
+        std::error_code error;
+        std::filesystem::remove_all(this->folder, error);
+        std::filesystem::create_directories(this->folder, error);
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            buckets[i].entryFile = this->folder + "/bucket-" + std::to_string(i);
+            buckets[i].keyFile = this->folder + "/keys-" + std::to_string(i);
+            buckets[i].retry = Backoff(options.bufferEntries);
+        }
+        recordFile = this->folder + "/records";
+    }
+
+    ~Drum()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+    }
+
+    Drum(const Drum &) = delete;
+    Drum &operator=(const Drum &) = delete;
+
+    // Queues key for the next merge. Returns true when a merge is due.
+    bool add(uint64_t key, const Record &record)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Bucket &bucket = buckets[bucketOf(key)];
+        bucket.buffer.push_back({key, held.fetch_add(1, std::memory_order_relaxed)});
+        records.push_back(record);
+        added++;
+        if (bucket.buffer.size() >= bucket.retry.at)
+            spill(bucket);
+        if (records.size() >= recordRetry.at)
+            spillRecords();
+        return bucket.spilled >= options.bucketLimit;
+    }
+
+    // Entries added and not yet released by a merge
+    size_t pending() const { return held.load(std::memory_order_relaxed); }
+
+    // Checks every held entry against the stored keys and stores the new ones,
+    // then calls release(record, isNew) for each in the order they were added.
+    // Returns how many were lost instead, their key or record unreadable, and
+    // so not released.
+    template <typename Release>
+    size_t merge(Release release)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = held.load(std::memory_order_relaxed);
+        if (count == 0)
+            return 0;
+        merges++;
+        // Lost until a bucket reads back its key
+        std::vector<Status> status(count, Lost);
+        for (auto &bucket : buckets)
+        {
+            if (bucket.spilled || !bucket.buffer.empty())
+                mergeBucket(bucket, status);
+        }
+
+        // Spilled records first, then the buffer: arrival order
+        size_t arrival = 0;
+        size_t lost = 0;
+        if (spilledRecords)
+        {
+            std::ifstream file(recordFile, std::ios::binary);
+            std::vector<Record> chunk;
+            while (arrival < spilledRecords)
+            {
+                chunk.resize(std::min(keyBuffer, spilledRecords - arrival));
+                if (!file.read(reinterpret_cast<char *>(chunk.data()), chunk.size() * sizeof(Record)))
+                {
+                    std::cerr << "Could not read DRUM records " << recordFile << "\n";
+                    lost = spilledRecords - arrival;
+                    arrival = spilledRecords;
+                    break;
+                }
+                bytesRead += chunk.size() * sizeof(Record);
+                for (const auto &record : chunk)
+                    lost += releaseOne(release, record, status[arrival++]);
+            }
+            std::error_code error;
+            std::filesystem::resize_file(recordFile, 0, error);
+            spilledRecords = 0;
+        }
+        for (const auto &record : records)
+            lost += releaseOne(release, record, status[arrival++]);
+        records.clear();
+        held.store(0, std::memory_order_relaxed);
+        lostTotal += lost;
+        return lost;
+    }
+
+    void report(std::ostream &out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t stored = 0;
+        for (const auto &bucket : buckets)
+            stored += bucket.stored;
+        out << "drum: " << stored << " keys stored in " << buckets.size() << " buckets, " << pending() << " waiting, "
+            << merges << " merges; " << unique << " new of " << added - pending() << " checked";
+        if (lostTotal)
+            out << ", " << lostTotal << " lost to read errors";
+        out << "; read "
+            << bytesRead / (1024 * 1024) << " MiB, wrote " << bytesWritten / (1024 * 1024) << " MiB\n";
+    }
+
+private:
+    // A key and its arrival number since the last merge
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t arrival;
+
+        bool operator<(const Entry &other) const
+        {
+            return key < other.key || (key == other.key && arrival < other.arrival);
+        }
+    };
+
+    enum Status : uint8_t
+    {
+        Lost,
+        Known,
+        New
+    };
+
+    // When to try a failed write again: at is the buffer size that triggers it
+    struct Backoff
+    {
+        explicit Backoff(size_t base = 1) : base(base), at(base) {}
+
+        // Returns true for the first failure in a row, the one to report
+        bool failed(size_t size)
+        {
+            step = step ? std::min(step * 2, base) : std::max<size_t>(base / 4, 1);
+            at = size + step;
+            return failures++ == 0;
+        }
+
+        // Returns the failures that came before
+        size_t succeeded()
+        {
+            size_t before = failures;
+            at = base;
+            step = 0;
+            failures = 0;
+            return before;
+        }
+
+        size_t base;
+        size_t at;
+        size_t step = 0;
+        size_t failures = 0;
+    };
+
+    struct Bucket
+    {
+        std::vector<Entry> buffer;
+        Backoff retry;
+        std::string entryFile;
+        std::string keyFile;
+        // Entries appended to entryFile, and keys in keyFile
+        size_t spilled = 0;
+        size_t stored = 0;
+    };
+
+    size_t bucketOf(uint64_t key) const
+    {
+        return static_cast<size_t>((static_cast<unsigned __int128>(key) * buckets.size()) >> 64);
+    }
+
+    template <typename Release>
+    static size_t releaseOne(Release &release, const Record &record, Status status)
+    {
+        if (status == Lost)
+            return 1;
+        release(record, status == New);
+        return 0;
+    }
+
+    // Appends bytes at data to filename, which holds offset bytes written
+    // before. Whatever a failed append left past offset is cut off first, so
+    // the entries after it are not shifted. Returns false on failure.
+    bool append(const std::string &filename, uint64_t offset, const void *data, size_t bytes)
+    {
+        std::error_code error;
+        if (std::filesystem::exists(filename, error) && std::filesystem::file_size(filename, error) != offset)
+        {
+            std::filesystem::resize_file(filename, offset, error);
+            if (error)
+                return false;
+        }
+        bool ok;
+        {
+            std::ofstream file(filename, std::ios::binary | std::ios::app);
+            file.write(static_cast<const char *>(data), bytes);
+            file.close();
+            ok = static_cast<bool>(file);
+        }
+        if (!ok)
+        {
+            std::filesystem::resize_file(filename, offset, error);
+            return false;
+        }
+        bytesWritten += bytes;
+        return true;
+    }
+
+    // On failure the entries stay in memory; the next merge picks them up there
+    void spill(Bucket &bucket)
+    {
+        if (!append(bucket.entryFile, bucket.spilled * sizeof(Entry), bucket.buffer.data(),
+                    bucket.buffer.size() * sizeof(Entry)))
+        {
+            if (bucket.retry.failed(bucket.buffer.size()))
+                std::cerr << "Could not write DRUM bucket " << bucket.entryFile << "; keeping its keys in memory\n";
+            return;
+        }
+        if (size_t failures = bucket.retry.succeeded())
+            std::cerr << "Wrote DRUM bucket " << bucket.entryFile << " after " << failures << " failed attempts\n";
+        bucket.spilled += bucket.buffer.size();
+        bucket.buffer.clear();
+    }
+
+    void spillRecords()
+    {
+        if (!append(recordFile, spilledRecords * sizeof(Record), records.data(), records.size() * sizeof(Record)))
+        {
+            if (recordRetry.failed(records.size()))
+                std::cerr << "Could not write DRUM records " << recordFile << "; keeping them in memory\n";
+            return;
+        }
+        if (size_t failures = recordRetry.succeeded())
+            std::cerr << "Wrote DRUM records " << recordFile << " after " << failures << " failed attempts\n";
+        spilledRecords += records.size();
+        records.clear();
+    }
+
+    void mergeBucket(Bucket &bucket, std::vector<Status> &status)
+    {
+        std::vector<Entry> entries(bucket.spilled);
+        if (bucket.spilled)
+        {
+            std::ifstream file(bucket.entryFile, std::ios::binary);
+            file.read(reinterpret_cast<char *>(entries.data()), entries.size() * sizeof(Entry));
+            if (!file)
+            {
+                // Their arrivals stay Lost: merge() counts them and does not
+                // release their records
+                std::cerr << "Could not read DRUM bucket " << bucket.entryFile << "; its entries are lost\n";
+                entries.clear();
+            }
+            bytesRead += entries.size() * sizeof(Entry);
+        }
+        entries.insert(entries.end(), bucket.buffer.begin(), bucket.buffer.end());
+        bucket.buffer.clear();
+        bucket.spilled = 0;
+        std::error_code error;
+        std::filesystem::resize_file(bucket.entryFile, 0, error);
+        // The first arrival of a key comes first among its equals
+        std::sort(entries.begin(), entries.end());
+
+        // One pass over the stored keys, writing them back with the new ones
+        std::ifstream stored(bucket.keyFile, std::ios::binary);
+        std::string merged = bucket.keyFile + ".tmp";
+        std::ofstream out(merged, std::ios::binary | std::ios::trunc);
+        KeyStream input(stored, bucket.stored);
+        std::vector<uint64_t> output;
+        output.reserve(keyBuffer);
+        auto emit = [&](uint64_t key)
+        {
+            output.push_back(key);
+            if (output.size() == keyBuffer)
+            {
+                out.write(reinterpret_cast<const char *>(output.data()), output.size() * sizeof(uint64_t));
+                output.clear();
+            }
+        };
+
+        size_t storedKeys = 0;
+        uint64_t current = 0;
+        bool more = input.next(current);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            uint64_t key = entries[i].key;
+            status[entries[i].arrival] = Known;
+            if (i > 0 && entries[i - 1].key == key)
+                continue;
+            while (more && current < key)
+            {
+                emit(current);
+                storedKeys++;
+                more = input.next(current);
+            }
+            if (more && current == key)
+                continue;
+            status[entries[i].arrival] = New;
+            emit(key);
+            storedKeys++;
+            unique++;
+        }
+        while (more)
+        {
+            emit(current);
+            storedKeys++;
+            more = input.next(current);
+        }
+        out.write(reinterpret_cast<const char *>(output.data()), output.size() * sizeof(uint64_t));
+        out.close();
+        bytesRead += input.read * sizeof(uint64_t);
+        if (out && !input.failed)
+            std::filesystem::rename(merged, bucket.keyFile, error);
+        if (!out || input.failed || error)
+        {
+            // The old keys stay; this batch is still released but not stored
+            std::cerr << "Could not update DRUM keys " << bucket.keyFile << "\n";
+            std::filesystem::remove(merged, error);
+        }
+        else
+        {
+            bucket.stored = storedKeys;
+            bytesWritten += storedKeys * sizeof(uint64_t);
+        }
+    }
+
+    static constexpr size_t keyBuffer = size_t(1) << 16;
+
+    // Buffered sequential reader of a key file
+    struct KeyStream
+    {
+        KeyStream(std::ifstream &file, size_t keys) : file(file), remaining(keys) {}
+
+        bool next(uint64_t &key)
+        {
+            if (position == buffer.size())
+            {
+                size_t count = std::min(keyBuffer, remaining);
+                if (count == 0)
+                    return false;
+                buffer.resize(count);
+                if (!file.read(reinterpret_cast<char *>(buffer.data()), count * sizeof(uint64_t)))
+                {
+                    failed = true;
+                    return false;
+                }
+                remaining -= count;
+                read += count;
+                position = 0;
+            }
+            key = buffer[position++];
+            return true;
+        }
+
+        std::ifstream &file;
+        std::vector<uint64_t> buffer;
+        size_t position = 0;
+        size_t remaining;
+        size_t read = 0;
+        bool failed = false;
+    };
+
+    std::string folder;
+    DrumOptions options;
+    mutable std::mutex mutex;
+    std::vector<Bucket> buckets;
+    // Records of the held entries, in arrival order: the first spilledRecords
+    // in recordFile, the rest in memory
+    std::string recordFile;
+    std::vector<Record> records;
+    size_t spilledRecords = 0;
+    Backoff recordRetry;
+    std::atomic<size_t> held{0};
+    size_t added = 0;
+    size_t unique = 0;
+    size_t merges = 0;
+    // Entries merge() could not release, over all merges
+    size_t lostTotal = 0;
+    size_t bytesRead = 0;
+    size_t bytesWritten = 0;
+};
@@ -0,0 +1,424 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <libxml/tree.h>
+#include "arena.h"
+#include "resolve.h"
+#include "url_parse.h"
+
+// What an extracted reference points at. Pages are crawled, everything else is
+// downloaded next to the page that referenced it.
+enum rtype
+{
+    PAGE,
+    FRAME,
+    REFRESH,
+    STYLESHEET,
+    SCRIPT,
+    IMAGE,
+    MEDIA,
+    FONT,
+    ICON,
+    PRELOAD
+};
+
+// url is absolute, well formed and crawlable; parts are its component offsets
+struct Resource
+{
+    std::string_view url;
+    rtype type;
+    UrlComponents parts;
+};
+
+// Everything extracted from one page. The URLs live in the arena, so the
+// whole result is released in O(1) by clear() once the page is handed on.
+struct PageResources
+{
+    Arena arena;
+    SmallVector<Resource, 64> items;
+    // References dropped as malformed or not crawlable
+    size_t rejected = 0;
+    // pageSimhash() of the page, 0 if it is empty
+    uint64_t simhash = 0;
+    // Hash of the words of its visible text, in order
+    uint64_t textHash = 0;
+
+    void clear()
+    {
+        items.clear();
+        arena.reset();
+        rejected = 0;
+        simhash = 0;
+        textHash = 0;
+    }
+};
+
+// How the value of a matched attribute is turned into resources
+enum amode
+{
+    PLAIN,        // the value is one URL
+    SRCSET,       // comma separated "url descriptor" candidates
+    LINK_REL,     // kind depends on the rel (and as) tokens of the element
+    META_REFRESH, // only when http-equiv="refresh", URL follows "url="
+    BASE_HREF     // replaces the base used for the rest of the document
+};
+
+struct AttrRule
+{
+    const char *attr;
+    rtype type;
+    amode mode;
+};
+
+struct TagRule
+{
+    std::string_view tag;
+    std::array<AttrRule, 3> attrs;
+    int count;
+};
+
+constexpr TagRule tagRules[] = {
+    {"a", {{{"href", PAGE, PLAIN}}}, 1},
+    {"area", {{{"href", PAGE, PLAIN}}}, 1},
+    {"base", {{{"href", PAGE, BASE_HREF}}}, 1},
+    {"link", {{{"href", STYLESHEET, LINK_REL}}}, 1},
+    {"script", {{{"src", SCRIPT, PLAIN}}}, 1},
+    {"img", {{{"src", IMAGE, PLAIN}, {"srcset", IMAGE, SRCSET}}}, 2},
+    {"iframe", {{{"src", FRAME, PLAIN}}}, 1},
+    {"frame", {{{"src", FRAME, PLAIN}}}, 1},
+    {"source", {{{"src", MEDIA, PLAIN}, {"srcset", IMAGE, SRCSET}}}, 2},
+    {"video", {{{"src", MEDIA, PLAIN}, {"poster", IMAGE, PLAIN}}}, 2},
+    {"audio", {{{"src", MEDIA, PLAIN}}}, 1},
+    {"track", {{{"src", MEDIA, PLAIN}}}, 1},
+    {"embed", {{{"src", MEDIA, PLAIN}}}, 1},
+    {"input", {{{"src", IMAGE, PLAIN}}}, 1},
+    {"meta", {{{"content", REFRESH, META_REFRESH}}}, 1},
+};
+
+constexpr size_t tagRuleCount = sizeof(tagRules) / sizeof(tagRules[0]);
+
+constexpr size_t tagTableBits = 5;
+constexpr size_t tagTableSize = size_t(1) << tagTableBits;
+
+constexpr uint32_t tagHash(std::string_view name)
+{
+    uint32_t h = 2166136261u;
+    for (char c : name)
+        h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    return h;
+}
+
+constexpr uint32_t tagHash(const char *name) { return tagHash(std::string_view(name)); }
+
+constexpr uint32_t tagSlot(uint32_t hash, uint32_t multiplier)
+{
+    return (hash * multiplier) >> (32 - tagTableBits);
+}
+
+// Searches for a multiplier under which every tag in tagRules lands in its
+// own slot
+constexpr uint32_t findTagMultiplier()
+{
+    for (uint32_t multiplier = 0x9E3779B1u;; multiplier += 2)
+    {
+        bool used[tagTableSize] = {};
+        bool collision = false;
+        for (size_t i = 0; i < tagRuleCount && !collision; i++)
+        {
+            uint32_t slot = tagSlot(tagHash(tagRules[i].tag), multiplier);
+            collision = used[slot];
+            used[slot] = true;
+        }
+        if (!collision)
+            return multiplier;
+    }
+}
+
+constexpr uint32_t tagMultiplier = findTagMultiplier();
+
+constexpr std::array<int8_t, tagTableSize> buildTagTable()
+{
+    std::array<int8_t, tagTableSize> table = {};
+    for (auto &slot : table)
+        slot = -1;
+    for (size_t i = 0; i < tagRuleCount; i++)
+        table[tagSlot(tagHash(tagRules[i].tag), tagMultiplier)] = static_cast<int8_t>(i);
+    return table;
+}
+
+constexpr std::array<int8_t, tagTableSize> tagTable = buildTagTable();
+
+// One probe into the perfect hash; nullptr when the tag carries no resources
+inline const TagRule *findTagRule(const char *name)
+{
+    int8_t index = tagTable[tagSlot(tagHash(name), tagMultiplier)];
+    if (index < 0 || tagRules[index].tag != name)
+        return nullptr;
+    return &tagRules[index];
+}
+
+inline bool asciiIEquals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z')
+            x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z')
+            y += 'a' - 'A';
+        if (x != y)
+            return false;
+    }
+    return true;
+}
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+inline std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && isSpace(s.front()))
+        s.remove_prefix(1);
+    while (!s.empty() && isSpace(s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Attribute value without copying it out of the tree; the HTML parser stores
+// attribute values as a single text child.
+inline std::string_view attrValue(const xmlAttr *attr)
+{
+    const xmlNode *text = attr->children;
+    if (!text || text->type != XML_TEXT_NODE || !text->content)
+        return {};
+    return reinterpret_cast<const char *>(text->content);
+}
+
+inline std::string_view findAttr(const xmlNode *node, const char *name)
+{
+    for (const xmlAttr *attr = node->properties; attr; attr = attr->next)
+    {
+        if (strcmp(reinterpret_cast<const char *>(attr->name), name) == 0)
+            return attrValue(attr);
+    }
+    return {};
+}
+
+// Picks the resource kind of a <link> from its rel tokens, or false when the
+// link does not point at anything we fetch (canonical, alternate, ...).
+inline bool linkType(const xmlNode *node, rtype &type)
+{
+    std::string_view rel = findAttr(node, "rel");
+    while (!rel.empty())
+    {
+        size_t start = 0;
+        while (start < rel.size() && isSpace(rel[start]))
+            start++;
+        size_t end = start;
+        while (end < rel.size() && !isSpace(rel[end]))
+            end++;
+        std::string_view token = rel.substr(start, end - start);
+        rel.remove_prefix(end);
+
+        if (asciiIEquals(token, "stylesheet"))
+        {
+            type = STYLESHEET;
+            return true;
+        }
+        if (asciiIEquals(token, "icon") || asciiIEquals(token, "apple-touch-icon"))
+        {
+            type = ICON;
+            return true;
+        }
+        if (asciiIEquals(token, "modulepreload"))
+        {
+            type = SCRIPT;
+            return true;
+        }
+        if (asciiIEquals(token, "preload") || asciiIEquals(token, "prefetch"))
+        {
+            std::string_view as = findAttr(node, "as");
+            if (asciiIEquals(as, "style"))
+                type = STYLESHEET;
+            else if (asciiIEquals(as, "script"))
+                type = SCRIPT;
+            else if (asciiIEquals(as, "font"))
+                type = FONT;
+            else if (asciiIEquals(as, "image"))
+                type = IMAGE;
+            else
+                type = PRELOAD;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the target of a refresh directive such as "5; url=/next"
+inline std::string_view refreshTarget(std::string_view content)
+{
+    size_t i = 0;
+    while (i < content.size() && (isSpace(content[i]) || (content[i] >= '0' && content[i] <= '9') || content[i] == '.'))
+        i++;
+    if (i < content.size() && (content[i] == ';' || content[i] == ','))
+        i++;
+    while (i < content.size() && isSpace(content[i]))
+        i++;
+    if (content.size() - i >= 3 && asciiIEquals(content.substr(i, 3), "url"))
+    {
+        size_t j = i + 3;
+        while (j < content.size() && isSpace(content[j]))
+            j++;
+        if (j < content.size() && content[j] == '=')
+        {
+            i = j + 1;
+            while (i < content.size() && isSpace(content[i]))
+                i++;
+        }
+    }
+    std::string_view target = content.substr(i);
+    if (!target.empty() && (target.front() == '"' || target.front() == '\''))
+    {
+        size_t close = target.find(target.front(), 1);
+        target = target.substr(1, close == std::string_view::npos ? std::string_view::npos : close - 1);
+    }
+    return trim(target);
+}
+
+struct ExtractContext
+{
+    PageResources &resources;
+    // The page's own URL until a <base href> replaces it
+    std::string_view base;
+    bool baseSet = false;
+};
+
+// Resolves value against the current base straight into the page arena
+inline std::string_view resolve(ExtractContext &ctx, std::string_view value)
+{
+    char *out = static_cast<char *>(ctx.resources.arena.allocate(maxResolvedSize(ctx.base, value) + 1, 1));
+    size_t size = resolveUri(ctx.base, value, out);
+    if (size == 0)
+        return ctx.resources.arena.copy(value);
+    out[size] = '\0';
+    return std::string_view(out, size);
+}
+
+// Scheme of a reference, empty when it is relative
+inline std::string_view referenceScheme(std::string_view value)
+{
+    size_t pos = 0;
+    while (pos < value.size() && isSchemeChar(value[pos], pos == 0))
+        pos++;
+    return pos > 0 && pos < value.size() && value[pos] == ':' ? value.substr(0, pos) : std::string_view();
+}
+
+inline void addResource(ExtractContext &ctx, std::string_view value, rtype type)
+{
+    value = trim(value);
+    if (value.empty() || value.front() == '#')
+        return;
+    // mailto:, javascript:, data: and friends are dropped before resolving,
+    // which would copy them into the arena
+    std::string_view scheme = referenceScheme(value);
+    if (!scheme.empty() && !isCrawlableScheme(scheme))
+    {
+        ctx.resources.rejected++;
+        return;
+    }
+    Resource resource{resolve(ctx, value), type, {}};
+    if (!parseUrl(resource.url, resource.parts) || !isCrawlableScheme(resource.parts.scheme(resource.url)))
+    {
+        ctx.resources.rejected++;
+        return;
+    }
+    ctx.resources.items.push_back(resource);
+}
+
+inline void addSrcset(ExtractContext &ctx, std::string_view srcset, rtype type)
+{
+    size_t i = 0;
+    while (i < srcset.size())
+    {
+        while (i < srcset.size() && (isSpace(srcset[i]) || srcset[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < srcset.size() && !isSpace(srcset[i]))
+            i++;
+        std::string_view url = srcset.substr(start, i - start);
+        while (!url.empty() && url.back() == ',')
+            url.remove_suffix(1);
+        addResource(ctx, url, type);
+
+        // Skip the width/density descriptor
+        while (i < srcset.size() && srcset[i] != ',')
+            i++;
+    }
+}
+
+inline void extractElement(ExtractContext &ctx, const xmlNode *node, const TagRule &rule)
+{
+    for (const xmlAttr *attr = node->properties; attr; attr = attr->next)
+    {
+        const char *name = reinterpret_cast<const char *>(attr->name);
+        for (int i = 0; i < rule.count; i++)
+        {
+            const AttrRule &attrRule = rule.attrs[i];
+            if (strcmp(name, attrRule.attr) != 0)
+                continue;
+
+            std::string_view value = attrValue(attr);
+            switch (attrRule.mode)
+            {
+            case PLAIN:
+                addResource(ctx, value, attrRule.type);
+                break;
+            case SRCSET:
+                addSrcset(ctx, value, attrRule.type);
+                break;
+            case LINK_REL:
+            {
+                rtype type;
+                if (linkType(node, type))
+                    addResource(ctx, value, type);
+                break;
+            }
+            case META_REFRESH:
+                if (asciiIEquals(trim(findAttr(node, "http-equiv")), "refresh"))
+                    addResource(ctx, refreshTarget(value), attrRule.type);
+                break;
+            case BASE_HREF:
+                // Only the first <base> counts
+                if (!ctx.baseSet && !trim(value).empty())
+                {
+                    ctx.base = resolve(ctx, trim(value));
+                    ctx.baseSet = true;
+                }
+                break;
+            }
+        }
+    }
+}
+
+inline void traverse(ExtractContext &ctx, const xmlNode *node)
+{
+    while (node)
+    {
+        if (node->type == XML_ELEMENT_NODE)
+        {
+            if (const TagRule *rule = findTagRule(reinterpret_cast<const char *>(node->name)))
+                extractElement(ctx, node, *rule);
+        }
+
+        traverse(ctx, node->children);
+        node = node->next;
+    }
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <openssl/evp.h>
+
+// Two kinds of URL fingerprint:
+//  - SHA-256 in hex, stable across runs and machines, for on-disk names;
+//  - a fast non-cryptographic 64/128-bit hash for in-memory dedupe
+//    structures, where only speed and spread matter.
+
+constexpr std::array<char, 512> buildHexTable()
+{
+    const char digits[] = "0123456789abcdef";
+    std::array<char, 512> table = {};
+    for (int i = 0; i < 256; i++)
+    {
+        table[2 * i] = digits[i >> 4];
+        table[2 * i + 1] = digits[i & 15];
+    }
+    return table;
+}
+
+constexpr std::array<char, 512> hexTable = buildHexTable();
+
+// Writes 2 * size lowercase hex digits to out
+inline void toHex(const unsigned char *bytes, size_t size, char *out)
+{
+    for (size_t i = 0; i < size; i++)
+        memcpy(out + 2 * i, &hexTable[2 * bytes[i]], 2);
+}
+
+constexpr size_t sha256Size = 32;
+
+// SHA-256 through the EVP interface. The digest is fetched once and every
+// thread reuses one context; EVP_Digest() with EVP_sha256() would look the
+// implementation up and build a context on each call, which costs more than
+// hashing a URL.
+inline bool sha256(std::string_view data, unsigned char (&digest)[sha256Size])
+{
+    static EVP_MD *md = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+    thread_local std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    unsigned int size = 0;
+    return md && context && EVP_DigestInit_ex(context.get(), md, nullptr) == 1 &&
+           EVP_DigestUpdate(context.get(), data.data(), data.size()) == 1 &&
+           EVP_DigestFinal_ex(context.get(), digest, &size) == 1 && size == sha256Size;
+}
+
+// SHA-256 of url in hex, or "" if OpenSSL failed; never a stand-in value,
+// which would give every URL the same name
+inline std::string hashURL(std::string_view url)
+{
+    unsigned char digest[sha256Size];
+    if (!sha256(url, digest))
+        return "";
+    std::string hex(2 * sha256Size, '\0');
+    toHex(digest, sha256Size, hex.data());
+    return hex;
+}
+
+// 64-bit hash after wyhash (final version 4, public domain): 64x64->128 bit
+// multiply-and-fold mixing over 16- or 48-byte strides
+namespace wy
+{
+constexpr uint64_t secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+                                0x4d5a2da51de1aa47ull};
+
+inline void mum(uint64_t &a, uint64_t &b)
+{
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    mum(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read8(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read4(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t read3(const unsigned char *p, size_t k)
+{
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+inline uint64_t hash(const void *key, size_t len, uint64_t seed)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(key);
+    seed ^= mix(seed ^ secret[0], secret[1]);
+    uint64_t a, b;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = read3(p, len);
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+} // namespace wy
+
+inline uint64_t fingerprint64(std::string_view data, uint64_t seed = 0)
+{
+    return wy::hash(data.data(), data.size(), seed);
+}
+
+struct Fingerprint128
+{
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const Fingerprint128 &other) const { return low == other.low && high == other.high; }
+};
+
+// Two independently seeded 64-bit hashes, for sets large enough that 64-bit
+// collisions start to matter
+inline Fingerprint128 fingerprint128(std::string_view data)
+{
+    return {fingerprint64(data, 0), fingerprint64(data, 0x9e3779b97f4a7c15ull)};
+}
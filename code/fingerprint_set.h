@@ -0,0 +1,193 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Swiss-table style open addressing. Every slot has a control byte: 0x80
+// while it is empty, otherwise 7 bits of the hash of its key. Slots come in
+// groups of 16 whose control bytes are compared with one SSE2 instruction, so
+// a probe touches one cache line of control bytes and only looks at keys whose
+// tag matches. Groups are probed in triangular order, which visits every group
+// of a power of two table. There are no deletions, hence no tombstones.
+constexpr uint8_t emptyControl = 0x80;
+constexpr size_t groupWidth = 16;
+
+// Bit i is set when control byte i of the group equals tag
+inline uint32_t matchTag(const uint8_t *group, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i control = _mm_load_si128(reinterpret_cast<const __m128i *>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(static_cast<char>(tag))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < groupWidth; i++)
+        mask |= uint32_t(group[i] == tag) << i;
+    return mask;
+#endif
+}
+
+// Bit i is set when slot i of the group is empty
+inline uint32_t matchEmpty(const uint8_t *group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < groupWidth; i++)
+        mask |= uint32_t(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+// 16-byte aligned control bytes for groups groups, all empty
+inline std::unique_ptr<uint8_t[], void (*)(void *)> allocateControl(size_t groups)
+{
+    void *memory = nullptr;
+    if (posix_memalign(&memory, groupWidth, groups * groupWidth) != 0)
+        throw std::bad_alloc();
+    memset(memory, emptyControl, groups * groupWidth);
+    return {static_cast<uint8_t *>(memory), free};
+}
+
+// Set of 64-bit fingerprints such as fingerprint64() of a URL. The fingerprint
+// is its own hash: the low bits pick the group, the top 7 bits are the tag.
+// It holds the recent keys of VisitedStore, the visited check of the
+// frontier. Not synchronised; callers lock around it.
+class FingerprintSet
+{
+public:
+    explicit FingerprintSet(size_t expected = 0) : control(nullptr, free) { rehash(groupsFor(expected)); }
+
+    FingerprintSet(const FingerprintSet &) = delete;
+    FingerprintSet &operator=(const FingerprintSet &) = delete;
+
+    // Returns true if fingerprint was not in the set yet
+    bool insert(uint64_t fingerprint)
+    {
+        uint8_t tag = tagOf(fingerprint);
+        size_t group = fingerprint & groupMask;
+        for (size_t step = 1;; step++)
+        {
+            const uint8_t *controls = &control[group * groupWidth];
+            for (uint32_t hits = matchTag(controls, tag); hits; hits &= hits - 1)
+            {
+                if (keys[group * groupWidth + __builtin_ctz(hits)] == fingerprint)
+                    return false;
+            }
+            uint32_t empty = matchEmpty(controls);
+            if (empty)
+            {
+                if ((count + 1) * 8 > (groupMask + 1) * groupWidth * 7)
+                {
+                    // Past 7/8 full: grow, then place it in the new table
+                    rehash((groupMask + 1) * 2);
+                    place(fingerprint);
+                }
+                else
+                {
+                    size_t slot = group * groupWidth + __builtin_ctz(empty);
+                    control[slot] = tag;
+                    keys[slot] = fingerprint;
+                }
+                count++;
+                return true;
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    bool contains(uint64_t fingerprint) const
+    {
+        uint8_t tag = tagOf(fingerprint);
+        size_t group = fingerprint & groupMask;
+        for (size_t step = 1;; step++)
+        {
+            const uint8_t *controls = &control[group * groupWidth];
+            for (uint32_t hits = matchTag(controls, tag); hits; hits &= hits - 1)
+            {
+                if (keys[group * groupWidth + __builtin_ctz(hits)] == fingerprint)
+                    return true;
+            }
+            if (matchEmpty(controls))
+                return false;
+            group = (group + step) & groupMask;
+        }
+    }
+
+    size_t size() const { return count; }
+
+    // Empties the set, keeping its memory
+    void clear()
+    {
+        memset(control.get(), emptyControl, (groupMask + 1) * groupWidth);
+        count = 0;
+    }
+
+    // Calls visit(fingerprint) for every member, in no particular order
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (size_t slot = 0; slot < (groupMask + 1) * groupWidth; slot++)
+        {
+            if (control[slot] != emptyControl)
+                visit(keys[slot]);
+        }
+    }
+
+    // Bytes held by the control bytes and the keys
+    size_t memoryBytes() const { return (groupMask + 1) * groupWidth * (1 + sizeof(uint64_t)); }
+
+private:
+    static uint8_t tagOf(uint64_t fingerprint) { return fingerprint >> 57; }
+
+    static size_t groupsFor(size_t expected)
+    {
+        size_t groups = 1;
+        while (groups * groupWidth * 7 < expected * 8)
+            groups *= 2;
+        return groups;
+    }
+
+    // Puts a fingerprint known to be absent into the first free slot
+    void place(uint64_t fingerprint)
+    {
+        size_t group = fingerprint & groupMask;
+        for (size_t step = 1;; step++)
+        {
+            uint32_t empty = matchEmpty(&control[group * groupWidth]);
+            if (empty)
+            {
+                size_t slot = group * groupWidth + __builtin_ctz(empty);
+                control[slot] = tagOf(fingerprint);
+                keys[slot] = fingerprint;
+                return;
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    void rehash(size_t groups)
+    {
+        auto oldControl = std::move(control);
+        auto oldKeys = std::move(keys);
+        size_t oldSlots = oldControl ? (groupMask + 1) * groupWidth : 0;
+        control = allocateControl(groups);
+        keys.reset(new uint64_t[groups * groupWidth]);
+        groupMask = groups - 1;
+        for (size_t slot = 0; slot < oldSlots; slot++)
+        {
+            if (oldControl[slot] != emptyControl)
+                place(oldKeys[slot]);
+        }
+    }
+
+    std::unique_ptr<uint8_t[], void (*)(void *)> control;
+    std::unique_ptr<uint64_t[]> keys;
+    size_t groupMask = 0;
+    size_t count = 0;
+};
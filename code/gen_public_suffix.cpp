@@ -0,0 +1,282 @@
+// Build-time generator: turns public_suffix_list.dat into the static trie
+// tables of public_suffix_table.h, used by public_suffix.h.
+//
+//   gen_public_suffix dependencies/public_suffix_list.dat > code/public_suffix_table.h
+//
+// Rules are stored as a trie over reversed labels. Edges go into an open
+// addressing table keyed by (parent node, label), so a lookup costs one hash
+// and usually one probe per label. Internationalized rules are added both in
+// UTF-8 and in punycode, since canonical URLs carry the latter.
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Node
+{
+    std::map<std::string, std::unique_ptr<Node>> children;
+    int flags = 0;
+    size_t index = 0;
+};
+
+// Same values as pslflag in public_suffix.h
+constexpr int ruleFlag = 1;
+constexpr int exceptionFlag = 2;
+constexpr int wildcardFlag = 4;
+
+// Must match the hashing in public_suffix.h: FNV-1a over the label bytes
+// from last to first, the order in which the lookup scans a host
+uint32_t pslHash(const std::string &label)
+{
+    uint32_t hash = 2166136261u;
+    for (auto c = label.rbegin(); c != label.rend(); ++c)
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+    return hash;
+}
+
+uint32_t pslSlot(uint32_t parent, uint32_t hash, int bits)
+{
+    return ((hash ^ (parent * 0x9e3779b9u)) * 0x85ebca6bu) >> (32 - bits);
+}
+
+std::u32string decodeUtf8(const std::string &s)
+{
+    std::u32string out;
+    for (size_t i = 0; i < s.size();)
+    {
+        unsigned char c = s[i];
+        int extra = c < 0x80 ? 0 : c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+        char32_t cp = extra == 0 ? c : c & (0x3f >> extra);
+        for (int k = 1; k <= extra && i + k < s.size(); k++)
+            cp = (cp << 6) | (s[i + k] & 0x3f);
+        out += cp;
+        i += extra + 1;
+    }
+    return out;
+}
+
+// RFC 3492 punycode of one label, with the "xn--" prefix
+std::string punycode(const std::string &label)
+{
+    const uint32_t base = 36, tmin = 1, tmax = 26, skew = 38, damp = 700;
+    std::u32string input = decodeUtf8(label);
+    std::string out;
+    for (char32_t c : input)
+    {
+        if (c < 0x80)
+            out += static_cast<char>(c);
+    }
+    size_t basic = out.size(), handled = basic;
+    if (basic > 0)
+        out += '-';
+
+    auto digit = [](uint32_t d) { return static_cast<char>(d < 26 ? 'a' + d : '0' + d - 26); };
+    auto adapt = [&](uint32_t delta, uint32_t points, bool first)
+    {
+        delta = first ? delta / damp : delta / 2;
+        delta += delta / points;
+        uint32_t k = 0;
+        while (delta > ((base - tmin) * tmax) / 2)
+        {
+            delta /= base - tmin;
+            k += base;
+        }
+        return k + (base - tmin + 1) * delta / (delta + skew);
+    };
+
+    uint32_t n = 128, delta = 0, bias = 72;
+    while (handled < input.size())
+    {
+        uint32_t m = UINT32_MAX;
+        for (char32_t c : input)
+        {
+            if (c >= n && c < m)
+                m = c;
+        }
+        delta += (m - n) * (handled + 1);
+        n = m;
+        for (char32_t c : input)
+        {
+            if (c < n)
+                delta++;
+            if (c == n)
+            {
+                uint32_t q = delta;
+                for (uint32_t k = base;; k += base)
+                {
+                    uint32_t t = k <= bias ? tmin : k >= bias + tmax ? tmax : k - bias;
+                    if (q < t)
+                        break;
+                    out += digit(t + (q - t) % (base - t));
+                    q = (q - t) / (base - t);
+                }
+                out += digit(q);
+                bias = adapt(delta, handled + 1, handled == basic);
+                delta = 0;
+                handled++;
+            }
+        }
+        delta++;
+        n++;
+    }
+    return "xn--" + out;
+}
+
+void addRule(Node &root, const std::vector<std::string> &labels, int flags)
+{
+    Node *node = &root;
+    for (auto label = labels.rbegin(); label != labels.rend(); ++label)
+    {
+        auto &child = node->children[*label];
+        if (!child)
+            child.reset(new Node());
+        node = child.get();
+    }
+    node->flags |= flags;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "usage: gen_public_suffix public_suffix_list.dat\n";
+        return 1;
+    }
+    std::ifstream list(argv[1]);
+    if (!list)
+    {
+        std::cerr << "Could not open " << argv[1] << "\n";
+        return 1;
+    }
+
+    Node root;
+    std::string line;
+    size_t rules = 0;
+    while (std::getline(list, line))
+    {
+        // A rule is the first whitespace separated token of a line
+        size_t end = line.find_first_of(" \t\r");
+        std::string rule = line.substr(0, end);
+        if (rule.empty() || rule.compare(0, 2, "//") == 0)
+            continue;
+        int flags = ruleFlag;
+        if (rule[0] == '!')
+        {
+            flags = exceptionFlag;
+            rule.erase(0, 1);
+        }
+
+        std::vector<std::string> labels, ascii;
+        bool international = false;
+        size_t start = 0;
+        while (start <= rule.size())
+        {
+            size_t dot = rule.find('.', start);
+            if (dot == std::string::npos)
+                dot = rule.size();
+            std::string label = rule.substr(start, dot - start);
+            bool nonAscii = false;
+            for (unsigned char c : label)
+                nonAscii |= c >= 0x80;
+            international |= nonAscii;
+            labels.push_back(label);
+            ascii.push_back(nonAscii ? punycode(label) : label);
+            start = dot + 1;
+        }
+        addRule(root, labels, flags);
+        if (international)
+            addRule(root, ascii, flags);
+        rules++;
+    }
+
+    // Breadth first layout keeps the children of every node contiguous. A
+    // node whose "*" child is a rule is flagged, sparing the lookup a search.
+    std::vector<Node *> order{&root};
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i]->index = i;
+        auto wildcard = order[i]->children.find("*");
+        if (wildcard != order[i]->children.end() && (wildcard->second->flags & ruleFlag))
+            order[i]->flags |= wildcardFlag;
+        for (auto &child : order[i]->children)
+            order.push_back(child.second.get());
+    }
+
+    std::string pool;
+    std::map<std::string, size_t> offsets;
+    std::vector<std::string> nodeLabels(order.size());
+    for (Node *node : order)
+    {
+        for (auto &child : node->children)
+        {
+            nodeLabels[child.second->index] = child.first;
+            if (!offsets.count(child.first))
+            {
+                offsets[child.first] = pool.size();
+                pool += child.first;
+            }
+        }
+    }
+
+    std::cout << "// Generated by gen_public_suffix from " << argv[1] << "; do not edit.\n"
+              << "// " << rules << " rules, " << order.size() << " trie nodes, " << pool.size() << " label bytes.\n"
+              << "#pragma once\n\n"
+              << "constexpr char pslLabels[] =";
+    for (size_t i = 0; i < pool.size(); i += 64)
+    {
+        std::cout << "\n    \"";
+        for (size_t j = i; j < pool.size() && j < i + 64; j++)
+        {
+            unsigned char c = pool[j];
+            if (c >= 0x80 || c == '"' || c == '\\')
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\%03o", c);
+                std::cout << escape;
+            }
+            else
+                std::cout << c;
+        }
+        std::cout << "\"";
+    }
+    // Edge table at most half full
+    int bits = 1;
+    while ((size_t(1) << bits) < 2 * order.size())
+        bits++;
+    std::vector<std::pair<uint32_t, uint32_t>> slots(size_t(1) << bits, {UINT32_MAX, UINT32_MAX});
+    for (Node *node : order)
+    {
+        for (auto &child : node->children)
+        {
+            uint32_t slot = pslSlot(node->index, pslHash(child.first), bits);
+            while (slots[slot].first != UINT32_MAX)
+                slot = (slot + 1) & (slots.size() - 1);
+            slots[slot] = {static_cast<uint32_t>(node->index), static_cast<uint32_t>(child.second->index)};
+        }
+    }
+
+    std::cout << ";\n\n"
+              << "constexpr PslNode pslNodes[] = {\n";
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        size_t label = i == 0 ? 0 : offsets[nodeLabels[i]];
+        std::cout << "    {" << label << ", " << nodeLabels[i].size() << ", " << order[i]->flags << "},\n";
+    }
+    std::cout << "};\n\n"
+              << "constexpr int pslSlotBits = " << bits << ";\n\n"
+              << "// {parent, child} node indexes; UINT32_MAX marks a free slot\n"
+              << "constexpr PslEdge pslEdges[] = {\n";
+    for (auto &slot : slots)
+    {
+        if (slot.first == UINT32_MAX)
+            std::cout << "    {UINT32_MAX, UINT32_MAX},\n";
+        else
+            std::cout << "    {" << slot.first << ", " << slot.second << "},\n";
+    }
+    std::cout << "};\n";
+    return 0;
+}
@@ -0,0 +1,290 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "fingerprint.h"
+#include "url_parse.h"
+
+// Learns, per host, the query parameters that do not change the page: session
+// ids and tracking or referral tags that the fixed drop list in CanonOptions
+// does not know about.
+//
+// Every fetched page with a query is sampled once per parameter. The URL with
+// that parameter removed names a group, and the first page of each group is
+// kept. When a later page of the group carries another value, the two pages
+// are compared: the same visible text, or SimHashes a few bits apart, is a
+// match. A parameter with enough matches and no mismatch is ignorable on its
+// host.
+//
+// Ignorable parameters are left out of the visited key of later URLs; the URL
+// fetched stays as linked. The rules and their evidence live in a text file,
+// one "host parameter matches mismatches state" line each, so they carry over
+// to later crawls and can be read or edited by hand.
+struct ParamLearningOptions
+{
+    // Matching pairs needed before a parameter is ignored
+    size_t minMatches = 3;
+    int maxSimhashDistance = 3;
+};
+
+class ParamLearner
+{
+public:
+    explicit ParamLearner(ParamLearningOptions options = ParamLearningOptions()) : options(options) {}
+
+    // Reads rules saved by an earlier crawl. A missing file is not an error.
+    bool load(const std::string &filename)
+    {
+        std::ifstream file(filename);
+        if (!file)
+            return true;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string line;
+        int number = 0;
+        bool ok = true;
+        while (std::getline(file, line))
+        {
+            number++;
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            std::string host, param;
+            Evidence evidence;
+            if (!(fields >> host >> param >> evidence.matches >> evidence.mismatches))
+            {
+                std::cerr << filename << ":" << number << ": not a parameter rule: " << line << "\n";
+                ok = false;
+                continue;
+            }
+            HostRules &rules = hostRules(host);
+            rules.params[param] = evidence;
+            if (ignorable(evidence))
+                rules.ignored.push_back(param);
+            loaded++;
+        }
+        return ok;
+    }
+
+    // Writes every rule, learned or still gathering evidence, replacing the file
+    bool save(const std::string &filename) const
+    {
+        std::string temporary = filename + ".tmp";
+        {
+            std::ofstream file(temporary);
+            if (!file)
+            {
+                std::cerr << "Could not write parameter rules: " << temporary << "\n";
+                return false;
+            }
+            file << "# host parameter matches mismatches state\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<std::string_view, const HostRules *> sorted;
+            for (const auto &entry : hosts)
+                sorted[entry.second.host] = &entry.second;
+            for (const auto &entry : sorted)
+            {
+                for (const auto &param : entry.second->params)
+                {
+                    // load() reads the line back as whitespace separated fields
+                    if (!savable(param.first))
+                        continue;
+                    file << entry.first << " " << param.first << " " << param.second.matches << " "
+                         << param.second.mismatches << " " << (ignorable(param.second) ? "ignored" : "kept") << "\n";
+                }
+            }
+        }
+        if (std::rename(temporary.c_str(), filename.c_str()) != 0)
+        {
+            std::cerr << "Could not replace parameter rules: " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Writes the visited key of a canonical URL into key: the URL without the
+    // parameters ignorable on its host. Returns false, leaving key alone, when
+    // there is nothing to remove.
+    bool strip(std::string_view url, const UrlComponents &parts, std::string &key)
+    {
+        if (!parts.hasQuery())
+            return false;
+        uint64_t host = fingerprint64(parts.host(url));
+        std::lock_guard<std::mutex> lock(mutex);
+        auto rules = hosts.find(host);
+        if (rules == hosts.end() || rules->second.ignored.empty())
+            return false;
+
+        const std::vector<std::string> &ignored = rules->second.ignored;
+        std::string_view query = parts.query(url);
+        bool removed = false;
+        size_t start = 0;
+        key.assign(url.substr(0, parts.queryStart));
+        while (start <= query.size())
+        {
+            size_t amp = query.find('&', start);
+            if (amp == std::string_view::npos)
+                amp = query.size();
+            std::string_view param = query.substr(start, amp - start);
+            start = amp + 1;
+            std::string_view name = param.substr(0, param.find('='));
+            // An empty piece, as in "a=1&&b=2", or a value without a name
+            if (name.empty())
+                continue;
+            if (std::find(ignored.begin(), ignored.end(), name) != ignored.end())
+            {
+                removed = true;
+                continue;
+            }
+            key += key.size() == parts.queryStart ? '?' : '&';
+            key.append(param);
+        }
+        key.append(url.substr(parts.fragmentStart));
+        return removed;
+    }
+
+    // Samples a fetched page by its visible text hash and SimHash
+    void observe(std::string_view url, const UrlComponents &parts, uint64_t textHash, uint64_t simhash)
+    {
+        if (!parts.hasQuery() || (!textHash && !simhash))
+            return;
+        std::string_view host = parts.host(url);
+        std::string_view query = parts.query(url);
+        // Reused between calls; the URL minus one parameter
+        thread_local std::string group;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        HostRules &rules = hostRules(host);
+        size_t start = 0;
+        while (start <= query.size())
+        {
+            size_t amp = query.find('&', start);
+            if (amp == std::string_view::npos)
+                amp = query.size();
+            std::string_view param = query.substr(start, amp - start);
+            size_t equals = param.find('=');
+            std::string_view name = param.substr(0, equals);
+            std::string_view value = equals == std::string_view::npos ? std::string_view() : param.substr(equals + 1);
+            if (name.empty())
+            {
+                start = amp + 1;
+                continue;
+            }
+
+            Evidence &evidence = rules.params[std::string(name)];
+            // Decided either way; nothing more to learn about it
+            if (evidence.mismatches || ignorable(evidence))
+            {
+                start = amp + 1;
+                continue;
+            }
+            group.assign(url.substr(0, parts.queryStart + 1 + start));
+            group.append(url.substr(parts.queryStart + 1 + amp));
+            start = amp + 1;
+
+            Sample page{fingerprint64(value), textHash, simhash};
+            auto first = samples.emplace(fingerprint64(group, fingerprint64(name)), page);
+            if (first.second || first.first->second.value == page.value)
+                continue;
+            const Sample &other = first.first->second;
+            if ((page.text && page.text == other.text) ||
+                __builtin_popcountll(page.simhash ^ other.simhash) <= options.maxSimhashDistance)
+                evidence.matches++;
+            else
+                evidence.mismatches++;
+            if (ignorable(evidence))
+            {
+                rules.ignored.emplace_back(name);
+                learned++;
+            }
+        }
+    }
+
+    // A new URL that turned out to be known once its key was stripped
+    void countAvoided(std::string_view host)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hostRules(host).avoided++;
+        avoided++;
+    }
+
+    // Totals, and with perHost the rules and savings of every host using one
+    void report(std::ostream &out, bool perHost) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded && !learned && !avoided)
+            return;
+        out << "params: " << loaded << " rules loaded, " << learned << " learned, " << avoided << " fetches avoided\n";
+        if (!perHost)
+            return;
+        for (const auto &entry : hosts)
+        {
+            const HostRules &rules = entry.second;
+            if (rules.ignored.empty())
+                continue;
+            out << "  " << rules.host << ":";
+            for (const auto &param : rules.ignored)
+                out << " " << param;
+            out << ", " << rules.avoided << " fetches avoided\n";
+        }
+    }
+
+private:
+    struct Evidence
+    {
+        size_t matches = 0;
+        size_t mismatches = 0;
+    };
+
+    struct HostRules
+    {
+        std::string host;
+        std::map<std::string, Evidence> params;
+        // Names of the ignorable parameters, checked on every discovered link
+        std::vector<std::string> ignored;
+        size_t avoided = 0;
+    };
+
+    // First page seen for a group: its parameter value and content
+    struct Sample
+    {
+        uint64_t value;
+        uint64_t text;
+        uint64_t simhash;
+    };
+
+    bool ignorable(const Evidence &evidence) const
+    {
+        return evidence.matches >= options.minMatches && evidence.mismatches == 0;
+    }
+
+    static bool savable(std::string_view name)
+    {
+        return !name.empty() && name.find_first_of(" \t\n\v\f\r") == std::string_view::npos;
+    }
+
+    HostRules &hostRules(std::string_view host)
+    {
+        HostRules &rules = hosts[fingerprint64(host)];
+        if (rules.host.empty())
+            rules.host.assign(host);
+        return rules;
+    }
+
+    ParamLearningOptions options;
+    mutable std::mutex mutex;
+    // Keyed by fingerprint64() of the host
+    std::unordered_map<uint64_t, HostRules> hosts;
+    std::unordered_map<uint64_t, Sample> samples;
+    size_t loaded = 0;
+    size_t learned = 0;
+    size_t avoided = 0;
+};
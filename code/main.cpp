@@ -7,25 +7,96 @@
 #include <filesystem>
 #include <libxml/HTMLparser.h>
 #include <libxml/tree.h>
-#include <libxml/uri.h>
 #include <queue>
-#include <set>
-#include <sstream>
-#include <openssl/sha.h>
-#include <iomanip>
-#include <regex>
-#include <libxml/uri.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <clocale>
+#include <array>
+#include <climits>
+#include <unordered_map>
+#include "mapped_file.h"
+#include "segmented_queue.h"
+#include "mpmc_ring.h"
+#include "priority_queue.h"
+#include "crawl_priority.h"
+#include "politeness.h"
+#include "visited_store.h"
+#include "drum.h"
+#include "checkpoint.h"
+#include "extract.h"
+#include "css_scan.h"
+#include "pipeline.h"
+#include "work_stealing.h"
+#include "canonical.h"
+#include "resolve.h"
+#include "url_parse.h"
+#include "url_table.h"
+#include "scope.h"
+#include "public_suffix.h"
+#include "learned_params.h"
+#include "trap.h"
+#include "fingerprint.h"
+#ifdef COUNT_ALLOCATIONS
+// Counts heap allocations made by the crawler and by libxml2, so --reparse can
+// report how many allocations extraction costs per page.
+std::atomic<uint64_t> allocationCount{0};
+
+void *operator new(size_t size)
+{
+    allocationCount++;
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void *countingMalloc(size_t size)
+{
+    allocationCount++;
+    return malloc(size);
+}
+
+void *countingRealloc(void *p, size_t size)
+{
+    allocationCount++;
+    return realloc(p, size);
+}
+
+char *countingStrdup(const char *s)
+{
+    allocationCount++;
+    return strdup(s);
+}
+#endif
+
 enum ftype
 {
     HTML,
     CSS,
-    JS
+    JS,
+    ASSET
 };
 
-struct URL
+ftype fileType(rtype type)
 {
-    char data[1000];
-};
+    switch (type)
+    {
+    case PAGE:
+    case FRAME:
+    case REFRESH:
+        return HTML;
+    case STYLESHEET:
+        return CSS;
+    case SCRIPT:
+        return JS;
+    default:
+        return ASSET;
+    }
+}
 
 void printer(std::vector<std::string> a)
 {
@@ -35,26 +106,26 @@ void printer(std::vector<std::string> a)
     }
 }
 
-std::string sanitize(std::string a)
+// Maps every byte to itself, except the characters that are not allowed in
+// file names, which become '_'
+constexpr std::array<char, 256> buildSanitizeTable()
 {
-    std::regex restrictedChars(R"([\\/:*?"<>|])");
-    return std::regex_replace(a, restrictedChars, "_");
+    std::array<char, 256> table = {};
+    for (int c = 0; c < 256; c++)
+        table[c] = static_cast<char>(c);
+    for (unsigned char c : std::string_view(R"(\/:*?"<>|)"))
+        table[c] = '_';
+    return table;
 }
 
-std::string hashURL(const std::string &url)
-{
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, url.c_str(), url.size());
-    SHA256_Final(hash, &sha256);
+constexpr std::array<char, 256> sanitizeTable = buildSanitizeTable();
 
-    std::ostringstream hexStream;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i)
-    {
-        hexStream << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    return hexStream.str();
+std::string sanitize(std::string_view a)
+{
+    std::string safe(a.size(), '\0');
+    for (size_t i = 0; i < a.size(); i++)
+        safe[i] = sanitizeTable[static_cast<unsigned char>(a[i])];
+    return safe;
 }
 
 size_t file_handler(char *buffer, size_t size, size_t nmemb, void *userdata)
@@ -64,281 +135,1363 @@ size_t file_handler(char *buffer, size_t size, size_t nmemb, void *userdata)
     return size * nmemb;
 }
 
-std::string generateFilename(const char *url)
+// Stored files are named after a readable prefix of the URL plus part of its
+// hash, so names stay unique and well below NAME_MAX however long the URL is.
+constexpr size_t maxNamePrefix = 96;
+
+// Extension kept for assets, taken from the last path segment of the URL
+std::string_view urlExtension(std::string_view url)
 {
-    std::string filename = hashURL(url);
-    return "storage/" + filename;
+    url = url.substr(0, url.find_first_of("?#"));
+    size_t slash = url.rfind('/');
+    size_t dot = url.rfind('.');
+    if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash) || url.size() - dot > 8)
+        return {};
+    return url.substr(dot);
+}
+
+std::string boundedName(std::string_view url, std::string_view hash)
+{
+    std::string name = sanitize(url.substr(0, maxNamePrefix));
+    if (url.size() > maxNamePrefix)
+    {
+        name += '-';
+        name.append(hash.substr(0, 16));
+    }
+    return name;
 }
 
-void traverse(xmlNode *node, std::vector<std::string> &hrefs, std::vector<std::string> &css, std::vector<std::string> &js, const std::string &baseUri)
+// Files of a session live in <session>/<aa>/<bb>/<name>, where aa and bb come
+// from hashURL(), so no directory grows past a few dozen entries even with
+// millions of files. index.txt in the session folder maps every stored file
+// back to its URL.
+class Storage
 {
-    while (node)
+public:
+    explicit Storage(std::string folder)
+        : folder(std::move(folder)), shardReady(new std::atomic<bool>[shardCount]())
+    {
+        std::filesystem::create_directories(this->folder);
+        manifest.open(this->folder + "/index.txt", std::ios::app);
+    }
+
+    // Full path for url, creating its shard directory on first use. Returns
+    // "" if url could not be hashed.
+    std::string pathFor(std::string_view url, ftype type)
     {
-        if (node->name)
+        unsigned char digest[sha256Size];
+        if (!sha256(url, digest))
         {
-            std::cout << reinterpret_cast<const char *>(node->name) << "\n";
+            std::cerr << "Error: Unable to hash " << url << " for a file name.\n";
+            return "";
         }
-
-        if (node->type == XML_ELEMENT_NODE)
+        char hash[2 * sha256Size];
+        toHex(digest, sha256Size, hash);
+        std::string shard(hash, 2);
+        shard += '/';
+        shard.append(hash + 2, 2);
+        size_t shardIndex = digest[0] << 8 | digest[1];
+        if (!shardReady[shardIndex].load(std::memory_order_acquire))
         {
-            std::string nodeName = reinterpret_cast<const char *>(node->name);
-
-            if (nodeName == "a")
-            {
-                for (xmlAttr *attr = node->properties; attr; attr = attr->next)
-                {
-                    if (std::string(reinterpret_cast<const char *>(attr->name)) == "href")
-                    {
-                        xmlChar *value = xmlNodeListGetString(node->doc, attr->children, 1);
-                        if (value)
-                        {
-                            xmlChar *absoluteUri = xmlBuildURI(value, reinterpret_cast<const xmlChar *>(baseUri.c_str()));
-                            if (absoluteUri)
-                            {
-                                hrefs.emplace_back(reinterpret_cast<const char *>(absoluteUri));
-                                xmlFree(absoluteUri);
-                            }
-                            else
-                                hrefs.emplace_back(reinterpret_cast<const char *>(value));
-                            xmlFree(value);
-                        }
-                    }
-                }
-            }
-            else if (nodeName == "link")
-            {
-                // Check for rel="stylesheet"
-                std::string rel;
-                for (xmlAttr *attr = node->properties; attr; attr = attr->next)
-                {
-                    if (std::string(reinterpret_cast<const char *>(attr->name)) == "rel")
-                    {
-                        rel = reinterpret_cast<const char *>(attr->children ? (const char *)attr->children->content : "");
-                    }
+            std::filesystem::create_directories(folder + "/" + shard);
+            shardReady[shardIndex].store(true, std::memory_order_release);
+        }
 
-                    if (std::string(reinterpret_cast<const char *>(attr->name)) == "href")
-                    {
-                        xmlChar *value = xmlNodeListGetString(node->doc, attr->children, 1);
-                        if (value)
-                        {
-                            // Only process link if rel="stylesheet"
-                            if (rel == "stylesheet")
-                            {
-                                xmlChar *absoluteUri = xmlBuildURI(value, reinterpret_cast<const xmlChar *>(baseUri.c_str()));
-                                if (absoluteUri)
-                                {
-                                    css.emplace_back(reinterpret_cast<const char *>(absoluteUri));
-                                    xmlFree(absoluteUri);
-                                }
-                                else
-                                    css.emplace_back(reinterpret_cast<const char *>(value));
-                            }
-                            xmlFree(value);
-                        }
-                    }
-                }
-            }
-            else if (nodeName == "script")
-            {
-                for (xmlAttr *attr = node->properties; attr; attr = attr->next)
-                {
-                    if (std::string(reinterpret_cast<const char *>(attr->name)) == "src")
-                    {
-                        xmlChar *value = xmlNodeListGetString(node->doc, attr->children, 1);
-                        if (value)
-                        {
-                            xmlChar *absoluteUri = xmlBuildURI(value, reinterpret_cast<const xmlChar *>(baseUri.c_str()));
-                            if (absoluteUri)
-                            {
-                                js.emplace_back(reinterpret_cast<const char *>(absoluteUri));
-                                xmlFree(absoluteUri);
-                            }
-                            else
-                                js.emplace_back(reinterpret_cast<const char *>(value));
-                            xmlFree(value);
-                        }
-                    }
-                }
-            }
+        std::string name = boundedName(url, std::string_view(hash, sizeof(hash)));
+        switch (type)
+        {
+        case HTML:
+            name += ".html";
+            break;
+        case CSS:
+            name += ".css";
+            break;
+        case JS:
+            name += ".js";
+            break;
+        case ASSET:
+            // Images, fonts and media keep the extension of their URL
+            if (url.size() > maxNamePrefix)
+                name += urlExtension(url);
+            break;
         }
+        return folder + "/" + shard + "/" + name;
+    }
 
-        traverse(node->children, hrefs, css, js, baseUri);
-        node = node->next;
+    // Appends "url -> path" to the manifest, path relative to the session
+    void record(std::string_view url, const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(manifestMutex);
+        manifest << url << " -> " << std::string_view(path).substr(folder.size() + 1) << "\n";
+        manifest.flush();
     }
+
+    const std::string folder;
+
+private:
+    static constexpr size_t shardCount = 256 * 256;
+
+    std::mutex manifestMutex;
+    std::ofstream manifest;
+    std::unique_ptr<std::atomic<bool>[]> shardReady;
+};
+
+std::string generateFilename(const char *url)
+{
+    std::string filename = hashURL(url);
+    if (filename.empty())
+        return "";
+    return "storage/" + filename;
 }
 
-void parse(const std::string &filename, std::vector<std::string> &hrefs, std::vector<std::string> &css, std::vector<std::string> &js, const URL &startURL)
+// Extracts the resources of a stored page, resolving them against the URL the
+// page was fetched from
+void parse(const std::string &filename, PageResources &resources, std::string_view pageURL)
 {
-    htmlDocPtr doc = htmlReadFile(filename.c_str(), nullptr, HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
+    MappedFile page(filename);
+    if (!page.valid() || page.size > INT_MAX)
+    {
+        std::cerr << "Error: Could not map the HTML file: " << filename << std::endl;
+        return;
+    }
+
+    htmlDocPtr doc = htmlReadMemory(page.data, static_cast<int>(page.size), filename.c_str(), nullptr, HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
     if (!doc)
     {
         std::cerr << "Error: Could not parse the HTML file: " << filename << std::endl;
         return;
     }
 
+    resources.simhash = pageSimhash(page.data, page.size, &resources.textHash);
     xmlNode *root_element = xmlDocGetRootElement(doc);
-    traverse(root_element, hrefs, css, js, startURL.data);
-    std::cout << "links";
-    // printer(hrefs);
-    std::cout << "css";
-    printer(css);
-    std::cout << "js";
-    printer(js);
-    std::cout << std::endl;
+#ifdef COUNT_ALLOCATIONS
+    uint64_t allocationsBefore = allocationCount;
+#endif
+    ExtractContext ctx{resources, pageURL};
+    traverse(ctx, root_element);
+    std::cout << "Extracted " << resources.items.size() << " resources from " << filename;
+    if (resources.rejected)
+        std::cout << " (" << resources.rejected << " rejected)";
+    std::cout << "\n";
+#ifdef COUNT_ALLOCATIONS
+    std::cout << "  " << allocationCount - allocationsBefore << " allocations during extraction\n";
+#endif
     xmlFreeDoc(doc);
-    xmlCleanupParser();
 }
 
-void getFile(const URL &target, const std::string &sessionFolder, ftype type)
+// Re-runs extraction over every page already stored under a folder, without
+// fetching anything. Pages listed in the folder's index.txt are resolved
+// against their own URL; folders without one fall back to startURL.
+void reparse(const std::string &folder, const std::string &startURL)
 {
-    std::filesystem::create_directory(sessionFolder);
-    std::string filename;
-    switch (type)
-    {
-    case HTML:
+    PageResources resources;
+    std::ifstream manifest(folder + "/index.txt");
+    std::string line;
+    bool listed = false;
+    while (std::getline(manifest, line))
     {
-        filename = sessionFolder + "/" + sanitize(target.data) + ".html";
-        break;
-    }
-    case CSS:
-    {
-        filename = sessionFolder + "/" + sanitize(target.data) + ".css";
-        break;
+        size_t arrow = line.find(" -> ");
+        if (arrow == std::string::npos)
+            continue;
+        listed = true;
+        std::string filename = folder + "/" + line.substr(arrow + 4);
+        if (std::filesystem::path(filename).extension() != ".html")
+            continue;
+
+        resources.clear();
+        parse(filename, resources, std::string_view(line).substr(0, arrow));
     }
-    case JS:
+    if (listed)
+        return;
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(folder))
     {
-        filename = sessionFolder + "/" + sanitize(target.data) + ".js";
-        break;
-    }
-    default:
-        break;
+        if (!entry.is_regular_file() || entry.path().extension() != ".html")
+            continue;
+
+        resources.clear();
+        parse(entry.path().string(), resources, startURL);
     }
+}
+
+// Saves url and returns the file name, or "" on failure. The HTTP status,
+// when asked for, is stored in status.
+std::string getFile(const char *url, Storage &storage, ftype type, long *status = nullptr)
+{
+    std::string filename = storage.pathFor(url, type);
+    if (filename.empty())
+        return "";
 
     std::ofstream file(filename, std::ios::binary);
     if (!file)
     {
         std::cerr << "Error: Unable to open file " << filename << " for writing.\n";
-        return;
+        return "";
     }
 
     CURL *handle = curl_easy_init();
     if (!handle)
     {
         std::cerr << "Error: Unable to initialize CURL.\n";
-        return;
+        return "";
     }
 
-    curl_easy_setopt(handle, CURLOPT_URL, target.data);
+    curl_easy_setopt(handle, CURLOPT_URL, url);
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, file_handler);
     curl_easy_setopt(handle, CURLOPT_WRITEDATA, &file);
+    // Fetches run on worker threads
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
     CURLcode res = curl_easy_perform(handle);
-
-    if (res != CURLE_OK)
-        std::cerr << "Error: CURL request failed.\n";
+    if (status)
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, status);
     curl_easy_cleanup(handle);
     file.close();
 
+    if (res != CURLE_OK)
+    {
+        std::cerr << "Error: CURL request failed for " << url << ".\n";
+        return "";
+    }
+
+    storage.record(url, filename);
     std::cout << "Page saved to: " << filename << "\n";
+    return filename;
 }
 
-void runHTML(URL *input)
+void runHTML(const char *url)
 {
-    std::string filename = generateFilename(input->data);
+    std::string filename = generateFilename(url);
+    if (filename.empty())
+        return;
     std::string command = "firefox file:///home/deathhauler/projects/web_crawler/" + filename;
     std::system(command.c_str());
 }
 
-std::string makeAbsoluteURL(const std::string &baseURL, const std::string &relativeURL)
+struct CrawlTask
+{
+    UrlId url;
+    // What the visited check goes by: url, or url without the query
+    // parameters learned as ignorable on its host
+    UrlId key;
+    int depth;
+    rtype type;
+    // The extracted spelling differed from the canonical one
+    bool respelled = false;
+    // Index of the link among the resources of the page it was found on
+    uint32_t position = 0;
+    // Fingerprint of the registrable domain, see siteOf()
+    uint64_t site = 0;
+    // Fingerprint of the host name, the key of its back queue
+    uint64_t host = 0;
+};
+
+// A saved page or stylesheet waiting to be parsed
+struct FetchedTask
+{
+    CrawlTask task;
+    std::string filename;
+    long status;
+};
+
+struct PipelineConfig
+{
+    int fetchThreads = 4;
+    // Workers of the pool that parses saved pages
+    int parseThreads = 2;
+    // Saved pages allowed to wait for a parser before fetchers block
+    size_t parseQueueDepth = 32;
+    // Links a parse task canonicalizes itself; the rest of the page's links
+    // are split off in tasks of this many, for idle workers to steal
+    size_t linkChunk = 64;
+    CanonOptions canon;
+    // Time between checkpoints of the crawl state, 0 for none; see
+    // checkpoint.h
+    std::chrono::seconds checkpointInterval{30};
+    // Include/exclude rules for discovered URLs; empty follows everything
+    ScopeFilter scope;
+    // Follow links to pages only within the registrable domain of the start
+    // URL; assets are still fetched from anywhere
+    bool sameSite = false;
+    // Most URLs fetched per registrable domain, 0 for no limit
+    size_t siteBudget = 0;
+    TrapOptions traps;
+    // Queued tasks kept in the frontier's priority heap; more wait in segment
+    // files of frontierSegment tasks each
+    size_t frontierHeap = size_t(1) << 21;
+    size_t frontierSegment = size_t(1) << 20;
+    // Per-host back queues behind the priority queue, and the spacing of
+    // requests to one host
+    PolitenessOptions politeness;
+    VisitedOptions visited;
+    // Check discovered URLs in DRUM batches instead of the visited store: for
+    // crawls so large that even the filter's rare trips to disk add up. New
+    // URLs reach the queue only when a batch is merged.
+    bool drum = false;
+    DrumOptions drumOptions;
+    // Learned ignorable query parameters, kept between crawls
+    std::string paramRules;
+    // Fetched URLs containing this count as pages of interest, to compare
+    // frontier priorities; empty counts nothing
+    std::string interest;
+};
+
+// URLs waiting to be fetched, shared by all stages. pending counts tasks that
+// are queued or still being worked on anywhere in the pipeline; the crawl is
+// over when it drops to zero.
+//
+// A URL enters the queue at most once: push() drops keys already seen, so a
+// link found on every page costs a filter probe rather than a queue entry.
+// Both the seen set and the queue spill to disk once they outgrow memory.
+// The queue hands out the best URL by Policy, see crawl_priority.h; a
+// rescored policy may queue a URL again, and pop() skips the stale copies.
+// It is the front of a Mercator frontier: URLs move from it, best first, into
+// per-host back queues, and pop() takes from a host that may be fetched from
+// now, see politeness.h.
+//
+// push() does not take the frontier lock: the checked links go into a
+// lock-free inbox, see mpmc_ring.h, as one batch, and pop() files them under
+// the lock it holds anyway.
+//
+// With config.drum the check is deferred instead: tasks wait in DRUM buckets,
+// counted as pending, until a bucket fills or the fetchers run out of work,
+// and a merge then queues the new ones in bulk.
+template <typename Policy>
+struct BasicFrontier
+{
+    std::mutex mutex;
+    std::condition_variable ready;
+    // A discovered link on its way from push() to the queue
+    struct Discovered
+    {
+        CrawlTask task;
+        // Site of the page it was found on
+        uint64_t from;
+        bool isNew;
+    };
+    MpmcRing<Discovered> inbox{size_t(1) << 16};
+    // Fetchers about to wait or waiting in pop(), for push() to wake
+    std::atomic<int> waiting{0};
+    PriorityQueue<CrawlTask> queue;
+    HostQueues<CrawlTask> hosts;
+    // Time fetchers spent in pop() waiting for a host to become ready
+    std::chrono::steady_clock::duration idle{0};
+    // A URL fetched from each host, to name it in reports
+    std::unordered_map<uint64_t, UrlId> hostUrls;
+    // Fingerprints of the visited keys ever queued; exactly one of the two
+    std::unique_ptr<VisitedStore> seen;
+    std::unique_ptr<Drum<CrawlTask>> drum;
+    UrlTable &urls;
+    // Indexed by the URL ID of the visited key: handed to a fetcher
+    std::vector<bool> fetched;
+    size_t peakQueued = 0;
+    std::atomic<size_t> pending{0};
+    bool done = false;
+    // A fetcher is merging DRUM buckets because the queue ran dry
+    bool merging = false;
+    // Held through a whole releaseDrum()
+    std::mutex releasing;
+    // URLs dropped at push as already seen, and how many of those were only
+    // recognised after canonicalization
+    size_t duplicates = 0;
+    size_t respelledDuplicates = 0;
+    // Indexed like fetched: links seen to each key, saturating
+    std::vector<uint32_t> inlinks;
+    // Links into each site from pages of other sites
+    std::unordered_map<uint64_t, uint32_t> siteInlinks;
+    uint64_t sequence = 0;
+    // URLs queued again with a higher score, and stale copies skipped
+    size_t requeued = 0;
+    size_t stale = 0;
+    // Pages of interest among the fetches; see PipelineConfig::interest
+    std::string interest;
+    size_t fetches = 0;
+    size_t interesting = 0;
+    size_t interestingFirst1000 = 0;
+
+    // Site limits, set before the crawl starts. homeSite is the site of the
+    // start URL.
+    bool sameSite = false;
+    uint64_t homeSite = 0;
+    size_t siteBudget = 0;
+    // URLs fetched per site, and links dropped by the limits above
+    std::unordered_map<uint64_t, size_t> siteFetches;
+    std::atomic<size_t> offSite{0};
+    size_t overBudget = 0;
+
+    // Set while checkpoints are taken: tasks queued as new and keys of tasks
+    // finished since the last one. finish() hands keys over without the lock.
+    bool journaling = false;
+    std::vector<CrawlTask> journal;
+    MpmcRing<UrlId> completions{size_t(1) << 16};
+    std::vector<UrlId> completed;
+    // Time the last checkpoint held the frontier lock
+    std::chrono::steady_clock::duration checkpointLocked{0};
+
+    // Spill files go under folder
+    BasicFrontier(UrlTable &urls, const std::string &folder, const PipelineConfig &config)
+        : queue(folder + "/frontier", config.frontierHeap, config.frontierSegment),
+          hosts(config.politeness.backQueues ? config.politeness.backQueues : 3 * config.fetchThreads, config.politeness),
+          urls(urls), interest(config.interest)
+    {
+        if (config.drum)
+            drum.reset(new Drum<CrawlTask>(folder + "/drum", config.drumOptions));
+        else
+            seen.reset(new VisitedStore(folder + "/visited", config.visited));
+    }
+
+    // Queues the new tasks among links found on a page of site from
+    void push(std::vector<CrawlTask> &tasks, uint64_t from = 0)
+    {
+        if (tasks.empty())
+            return;
+        if (drum)
+        {
+            pushDrum(tasks, from);
+            return;
+        }
+        // The whole batch is checked at once, outside the frontier lock, so a
+        // trip to disk does not hold up the fetchers
+        thread_local std::vector<uint64_t> keys;
+        thread_local std::vector<bool> isNew;
+        keys.clear();
+        for (const auto &task : tasks)
+            keys.push_back(fingerprint64(urls.get(task.key)));
+        seen->insert(keys, isNew);
+
+        thread_local std::vector<Discovered> batch;
+        batch.clear();
+        size_t added = 0;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            const CrawlTask &task = tasks[i];
+            if (sameSite && task.site != homeSite && fileType(task.type) == HTML)
+            {
+                offSite.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            batch.push_back({task, from, isNew[i]});
+            added += isNew[i];
+        }
+        if (batch.empty())
+            return;
+        // Pending before the fetchers can see them, so the count cannot drop
+        // to zero with links still in the inbox
+        pending.fetch_add(added);
+        size_t sent = inbox.push(batch.data(), batch.size());
+        if (sent < batch.size())
+        {
+            // Inbox full: file the rest here, after what is already in it
+            std::lock_guard<std::mutex> lock(mutex);
+            drainLocked();
+            for (size_t i = sent; i < batch.size(); i++)
+                fileLocked(batch[i]);
+            peakQueued = std::max(peakQueued, queued());
+            ready.notify_all();
+            return;
+        }
+        // Pairs with the fence in pop(): either this sees the fetcher waiting,
+        // or the fetcher sees the inbox is not empty
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0)
+        {
+            // Taking the lock, if only for a moment, means a fetcher between
+            // finding nothing and going to sleep cannot miss the notification
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.notify_all();
+        }
+    }
+
+    // Hands out the next URL of a host that may be fetched from now, checking
+    // the host out until fetchDone() is called. Returns false once the crawl is
+    // over.
+    bool pop(CrawlTask &task)
+    {
+        using Clock = std::chrono::steady_clock;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            if (done)
+                return false;
+            drainLocked();
+            refillLocked();
+            Clock::time_point now = Clock::now();
+            Clock::time_point next;
+            uint64_t host;
+            if (!hosts.take(now, task, host, next))
+            {
+                if (drum && drum->pending() && !merging && queue.empty() && next == Clock::time_point::max())
+                {
+                    // Out of work while URLs wait in DRUM: merge them now
+                    // rather than when a bucket fills
+                    merging = true;
+                    lock.unlock();
+                    releaseDrum();
+                    lock.lock();
+                    merging = false;
+                    ready.notify_all();
+                    continue;
+                }
+                waiting.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (inbox.empty())
+                {
+                    if (next == Clock::time_point::max())
+                        ready.wait(lock);
+                    else
+                        ready.wait_until(lock, next);
+                }
+                waiting.fetch_sub(1);
+                idle += Clock::now() - now;
+                continue;
+            }
+            if (task.key >= fetched.size())
+                fetched.resize(std::max<size_t>(urls.size(), task.key + 1));
+            if (fetched[task.key])
+            {
+                // Queued again with a higher score and already fetched
+                stale++;
+                hosts.putBack(host);
+                finishLocked();
+                continue;
+            }
+            fetched[task.key] = true;
+            // Charged when the fetch is about to happen, so a site's budget is
+            // not used up by links still waiting in the queue
+            size_t &count = siteFetches[task.site];
+            if (siteBudget == 0 || count < siteBudget)
+            {
+                count++;
+                hostUrls.emplace(task.host, task.url);
+                countInterest(task);
+                return true;
+            }
+            overBudget++;
+            hosts.putBack(host);
+            finishLocked();
+        }
+    }
+
+    // Returns the host of a task from pop() once its fetch, begun at started,
+    // is over
+    void fetchDone(const CrawlTask &task, std::chrono::steady_clock::time_point started)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hosts.finish(task.host, started, std::chrono::steady_clock::now());
+        ready.notify_all();
+    }
+
+    // Tasks waiting in the inbox, the priority queue and the back queues
+    size_t queued() const { return inbox.size() + queue.size() + hosts.size(); }
+
+    // Counts a task from pop() done, everything it discovered pushed
+    void finish(const CrawlTask &task)
+    {
+        if (journaling && !completions.push(task.key))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            collectLocked();
+            completed.push_back(task.key);
+        }
+        if (pending.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            ready.notify_all();
+        }
+    }
+
+    // Writes what changed since the last checkpoint to log. The lock is held
+    // only to cut it from the frontier, not while it is written.
+    bool checkpoint(Checkpoint<CrawlTask> &log)
+    {
+        using Clock = std::chrono::steady_clock;
+        typename Checkpoint<CrawlTask>::Delta delta;
+        uint32_t mark;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto start = Clock::now();
+            collectLocked();
+            delta.completed.swap(completed);
+            mark = inbox.pushMark();
+            checkpointLocked = Clock::now() - start;
+        }
+        // The links of every task counted complete above were pushed before
+        // it finished: DRUM releases them now, and the inbox has them once the
+        // pushes claimed so far are published
+        if (drum)
+            releaseDrum();
+        while (!inbox.published(mark))
+            std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto start = Clock::now();
+            drainLocked();
+            delta.tasks.swap(journal);
+            delta.state = saveLocked();
+            delta.urlCount = urls.size();
+            checkpointLocked += Clock::now() - start;
+        }
+        return log.write(urls, delta);
+    }
+
+    // Rebuilds the frontier from log before the crawl starts: URLs get their
+    // old IDs back, and every task not completed is queued again. Returns
+    // false if the checkpoint could not be read.
+    bool restore(Checkpoint<CrawlTask> &log)
+    {
+        std::vector<CrawlTask> batch;
+        auto requeue = [&]
+        {
+            restoreBatch(batch);
+            batch.clear();
+        };
+        size_t expected = 0;
+        std::string state;
+        bool loaded = log.load([&](std::string_view url) { return urls.intern(url).first == expected++; },
+                               [&](UrlId key)
+                               {
+                                   track(key);
+                                   fetched[key] = true;
+                               },
+                               [&](const CrawlTask &task)
+                               {
+                                   batch.push_back(task);
+                                   if (batch.size() >= 65536)
+                                       requeue();
+                               },
+                               state);
+        if (!loaded)
+            return false;
+        requeue();
+        if (drum)
+            mergeRestored();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        StateReader reader{state};
+        // Queueing the restored tasks has counted some already
+        sequence = std::max(sequence, reader.get<uint64_t>());
+        reader.getMap([&](uint64_t site, int64_t count) { siteFetches[site] = count; });
+        reader.getMap([&](uint64_t site, int64_t count) { siteInlinks[site] = count; });
+        auto now = std::chrono::steady_clock::now();
+        reader.getMap([&](uint64_t host, int64_t wait) { hosts.delay(host, now + std::chrono::nanoseconds(wait)); });
+        peakQueued = queued();
+        return true;
+    }
+
+private:
+    // Files every link waiting in the inbox
+    void drainLocked()
+    {
+        Discovered links[64];
+        size_t count;
+        bool any = false;
+        while ((count = inbox.pop(links, 64)) > 0)
+        {
+            for (size_t i = 0; i < count; i++)
+                fileLocked(links[i]);
+            any = true;
+        }
+        if (any)
+            peakQueued = std::max(peakQueued, queued());
+    }
+
+    void fileLocked(const Discovered &link)
+    {
+        if (link.task.site != link.from && link.from)
+            siteInlinks[link.task.site]++;
+        if (link.isNew)
+            queueLocked(link.task);
+        else if (relinkLocked(link.task))
+            pending.fetch_add(1);
+    }
+
+    // Moves the keys handed over by finish() into completed
+    void collectLocked()
+    {
+        UrlId keys[256];
+        size_t count;
+        while ((count = completions.pop(keys, 256)) > 0)
+            completed.insert(completed.end(), keys, keys + count);
+    }
+
+    // Checkpointed state besides the queued tasks and completed keys
+    std::string saveLocked()
+    {
+        StateWriter writer;
+        writer.put(sequence);
+        writer.putMap(siteFetches);
+        writer.putMap(siteInlinks);
+        writer.putMap(hosts.delays(std::chrono::steady_clock::now()));
+        return std::move(writer.bytes);
+    }
+
+    // Marks a batch of restored tasks seen, and queues those not completed
+    void restoreBatch(const std::vector<CrawlTask> &batch)
+    {
+        if (drum)
+        {
+            bool due = false;
+            for (const auto &task : batch)
+                due |= drum->add(fingerprint64(urls.get(task.key)), task);
+            if (due)
+                mergeRestored();
+            return;
+        }
+        thread_local std::vector<uint64_t> keys;
+        thread_local std::vector<bool> isNew;
+        keys.clear();
+        for (const auto &task : batch)
+            keys.push_back(fingerprint64(urls.get(task.key)));
+        seen->insert(keys, isNew);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            track(batch[i].key);
+            if (isNew[i] && !fetched[batch[i].key])
+            {
+                queueLocked(batch[i]);
+                pending++;
+            }
+        }
+    }
+
+    void mergeRestored()
+    {
+        drum->merge([&](const CrawlTask &task, bool isNew)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        track(task.key);
+                        if (isNew && !fetched[task.key])
+                        {
+                            queueLocked(task);
+                            pending++;
+                        }
+                    });
+    }
+
+    // Moves URLs from the priority queue into the back queues, best first,
+    // until the best one's host has no room
+    void refillLocked()
+    {
+        while (!queue.empty() && hosts.accepts(queue.top().host))
+        {
+            int64_t score = queue.topScore();
+            CrawlTask task;
+            queue.pop(task);
+            hosts.add(task.host, task, score);
+        }
+    }
+
+    // Hands the tasks to DRUM, merging if a bucket is full. They count as
+    // pending from here, so the crawl cannot end while they wait.
+    void pushDrum(std::vector<CrawlTask> &tasks, uint64_t from)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t kept = 0;
+            for (const auto &task : tasks)
+            {
+                if (sameSite && task.site != homeSite && fileType(task.type) == HTML)
+                {
+                    offSite++;
+                    continue;
+                }
+                if (task.site != from && from)
+                    siteInlinks[task.site]++;
+                tasks[kept++] = task;
+            }
+            tasks.resize(kept);
+            pending += kept;
+        }
+        bool due = false;
+        for (const auto &task : tasks)
+            due |= drum->add(fingerprint64(urls.get(task.key)), task);
+        if (due)
+            releaseDrum();
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.notify_all();
+    }
+
+    // Merges the DRUM buckets, queueing new tasks and dropping the rest
+    void releaseDrum()
+    {
+        // One merge at a time, handed over in full before the next begins, so
+        // a checkpoint's own merge returns only once everything added before
+        // it is queued
+        std::lock_guard<std::mutex> serial(releasing);
+        // Reused between merges; handed over in slices so a large merge does
+        // not hold every task in memory twice
+        thread_local std::vector<std::pair<CrawlTask, bool>> released;
+        released.clear();
+        auto handOver = [&]
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &entry : released)
+            {
+                if (entry.second)
+                    queueLocked(entry.first);
+                else if (!relinkLocked(entry.first))
+                    finishLocked();
+            }
+            peakQueued = std::max(peakQueued, queued());
+            released.clear();
+            ready.notify_all();
+        };
+        size_t lost = drum->merge([&](const CrawlTask &task, bool isNew)
+                                  {
+                                      released.emplace_back(task, isNew);
+                                      if (released.size() >= 65536)
+                                          handOver();
+                                  });
+        handOver();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < lost; i++)
+            finishLocked();
+    }
+
+    // Grows the per-key vectors to cover key
+    void track(UrlId key)
+    {
+        if (key >= inlinks.size())
+        {
+            size_t size = std::max<size_t>(urls.size(), key + 1);
+            inlinks.resize(size, 0);
+            fetched.resize(size);
+        }
+    }
+
+    LinkStats statsOf(const CrawlTask &task)
+    {
+        LinkStats stats;
+        stats.inlinks = inlinks[task.key];
+        auto site = siteInlinks.find(task.site);
+        if (site != siteInlinks.end())
+            stats.siteInlinks = site->second;
+        stats.sequence = sequence++;
+        return stats;
+    }
+
+    void queueLocked(const CrawlTask &task)
+    {
+        if (journaling)
+            journal.push_back(task);
+        track(task.key);
+        inlinks[task.key] = 1;
+        queue.push(task, Policy::score(task, statsOf(task)));
+    }
+
+    // Another link to a known key. Returns true if the key was queued again
+    // because its score went up.
+    bool relinkLocked(const CrawlTask &task)
+    {
+        duplicates++;
+        if (task.respelled)
+            respelledDuplicates++;
+        track(task.key);
+        uint32_t &count = inlinks[task.key];
+        if (count < UINT32_MAX)
+            count++;
+        if (!Policy::rescored || fetched[task.key] || (count & (count - 1)) != 0)
+            return false;
+        queue.push(task, Policy::score(task, statsOf(task)));
+        requeued++;
+        return true;
+    }
+
+    void countInterest(const CrawlTask &task)
+    {
+        fetches++;
+        if (interest.empty() || urls.get(task.url).find(interest) == std::string_view::npos)
+            return;
+        interesting++;
+        if (fetches <= 1000)
+            interestingFirst1000++;
+    }
+
+    void finishLocked()
+    {
+        if (pending.fetch_sub(1) == 1)
+        {
+            done = true;
+            ready.notify_all();
+        }
+    }
+};
+
+#ifndef CRAWL_PRIORITY
+#define CRAWL_PRIORITY ByDepth
+#endif
+using Frontier = BasicFrontier<CRAWL_PRIORITY>;
+
+// Site key of a canonical URL: its registrable domain, or the host itself for
+// IP addresses and hosts that are a public suffix
+uint64_t siteOf(std::string_view url, const UrlComponents &parts)
+{
+    std::string_view host = parts.host(url);
+    std::string_view domain = registrableDomain(host);
+    return fingerprint64(domain.empty() ? host : domain);
+}
+
+// Canonicalizes an extracted URL, reusing its parse, and queues it for the
+// frontier unless it falls into a crawler trap. The task fetches the canonical
+// URL; its key also has the query rewritten by visitKey() and the learned
+// parameters stripped.
+void discover(std::vector<CrawlTask> &discovered, UrlTable &urls, TrapDetector &traps, ParamLearner &params, std::string_view url, const UrlComponents &parts, int depth, rtype type, uint32_t position, const CanonOptions &options, std::string &scratch)
 {
-    xmlChar *absolute = xmlBuildURI(reinterpret_cast<const xmlChar *>(relativeURL.c_str()),
-                                    reinterpret_cast<const xmlChar *>(baseURL.c_str()));
-    std::string absoluteURL;
-    if (absolute)
+    canonicalize(url, parts, scratch, options);
+    UrlComponents canonicalParts;
+    if (!parseUrl(scratch, canonicalParts))
+        return;
+    auto [id, added] = urls.intern(scratch);
+    if (id == invalidUrlId || !traps.admit(scratch, canonicalParts, added, fileType(type) != HTML))
+        return;
+    UrlId key = id;
+    std::string_view keyUrl = scratch;
+    // Reused between calls
+    thread_local std::string rewritten;
+    thread_local std::string stripped;
+    UrlComponents keyParts = canonicalParts;
+    if (visitKey(scratch, canonicalParts, rewritten, options) && parseUrl(rewritten, keyParts))
+        keyUrl = rewritten;
+    bool learned = params.strip(keyUrl, keyParts, stripped);
+    if (learned)
+        keyUrl = stripped;
+    if (keyUrl.data() != scratch.data())
     {
-        absoluteURL = reinterpret_cast<const char *>(absolute);
-        xmlFree(absolute);
+        auto [keyId, keyAdded] = urls.intern(keyUrl);
+        if (keyId == invalidUrlId)
+            return;
+        key = keyId;
+        if (learned && added && !keyAdded)
+            params.countAvoided(canonicalParts.host(scratch));
     }
-    return absoluteURL;
+    discovered.push_back({id, key, depth, type, keyUrl != url, position, siteOf(scratch, canonicalParts),
+                          fingerprint64(canonicalParts.host(scratch))});
 }
 
-void crawl(URL startURL, int depth, std::set<std::string> &visited, const std::string &sessionFolder)
+// What parse tasks share for the length of a crawl
+struct ParseContext
 {
-    std::queue<std::pair<std::string, int>> queue;
-    queue.push({startURL.data, 0});
+    Frontier &frontier;
+    WorkStealingPool &pool;
+    StageStats &stats;
+    TrapDetector &traps;
+    ParamLearner &params;
+    int depth;
+    const PipelineConfig &config;
+};
 
-    while (!queue.empty())
+// A parsed page whose links may be canonicalized by several tasks at once
+struct ParsedPage
+{
+    FetchedTask fetched;
+    PageResources resources;
+    // Link tasks not yet done; the last one finishes the page
+    std::atomic<size_t> remaining{1};
+};
+
+// A page to parse into, reusing the arena blocks of one a task on this thread
+// finished with earlier
+std::shared_ptr<ParsedPage> newPage(const FetchedTask &fetched)
+{
+    thread_local std::vector<std::unique_ptr<ParsedPage>> spare;
+    ParsedPage *page;
+    if (spare.empty())
+        page = new ParsedPage;
+    else
     {
-        auto [currentURL, currentDepth] = queue.front();
-        queue.pop();
+        page = spare.back().release();
+        spare.pop_back();
+    }
+    page->fetched = fetched;
+    page->remaining.store(1);
+    return std::shared_ptr<ParsedPage>(page, [](ParsedPage *done)
+                                       {
+                                           done->resources.clear();
+                                           if (spare.size() < 8)
+                                               spare.emplace_back(done);
+                                           else
+                                               delete done;
+                                       });
+}
 
-        if (visited.find(currentURL) != visited.end() || currentDepth > depth)
+// Canonicalizes links [begin, end) of page and pushes those to follow into
+// the frontier
+void discoverLinks(ParseContext &context, ParsedPage &page, size_t begin, size_t end)
+{
+    std::vector<CrawlTask> discovered;
+    {
+        StageTimer timer(context.stats);
+        const CrawlTask &task = page.fetched.task;
+        const PipelineConfig &config = context.config;
+        UrlTable &urls = context.frontier.urls;
+        // Reused for every link this thread canonicalizes
+        thread_local std::string canonical;
+        for (uint32_t position = begin; position < end; position++)
         {
-            continue;
+            const auto &resource = page.resources.items[position];
+            if (!config.scope.allows(resource.url, resource.parts))
+                continue;
+            if (fileType(resource.type) != HTML)
+            {
+                discover(discovered, urls, context.traps, context.params, resource.url, resource.parts, task.depth, resource.type, position, config.canon, canonical);
+                continue;
+            }
+            if (task.depth + 1 <= context.depth)
+                discover(discovered, urls, context.traps, context.params, resource.url, resource.parts, task.depth + 1, resource.type, position, config.canon, canonical);
         }
-        visited.insert(currentURL);
-        std::cout << "Crawling: " << currentURL << " (Depth: " << currentDepth << ")\n";
+    }
+    context.frontier.push(discovered, page.fetched.task.site);
+}
 
-        std::string filename = sessionFolder + "/" + sanitize(currentURL) + ".html";
-        std::vector<std::string> hrefs;
-        std::vector<std::string> css;
-        std::vector<std::string> js;
-        parse(filename, hrefs, css, js, startURL);
+// Parses a saved page or stylesheet, as a task of the parse pool. Links past
+// the first linkChunk are spawned as tasks of their own: this worker usually
+// runs them next, with the page still in cache, unless an idle one steals them.
+void parsePage(ParseContext &context, const FetchedTask &fetched)
+{
+    std::shared_ptr<ParsedPage> page = newPage(fetched);
+    {
+        StageTimer timer(context.stats);
+        const CrawlTask &task = fetched.task;
+        std::string_view url = context.frontier.urls.get(task.url);
+        if (task.type == STYLESHEET)
+        {
+            MappedFile stylesheet(fetched.filename);
+            if (stylesheet.valid())
+                scanCSS(stylesheet.data, stylesheet.size, url, page->resources);
+        }
+        else
+        {
+            parse(fetched.filename, page->resources, url);
+            UrlComponents pageParts;
+            if (parseUrl(url, pageParts))
+            {
+                context.traps.observe(url, pageParts, page->resources.simhash);
+                // Error pages look alike whatever the query says
+                if (fetched.status >= 200 && fetched.status < 300)
+                    context.params.observe(url, pageParts, page->resources.textHash, page->resources.simhash);
+            }
+        }
+    }
 
-        URL target;
-        strncpy(target.data, currentURL.c_str(), sizeof(target.data) - 1);
-        target.data[sizeof(target.data) - 1] = '\0';
+    auto links = [&context, page](size_t begin, size_t end)
+    {
+        discoverLinks(context, *page, begin, end);
+        if (page->remaining.fetch_sub(1) == 1)
+            context.frontier.finish(page->fetched.task);
+    };
+    size_t count = page->resources.items.size();
+    size_t chunk = std::max<size_t>(context.config.linkChunk, 1);
+    for (size_t begin = chunk; begin < count; begin += chunk)
+    {
+        size_t end = std::min(begin + chunk, count);
+        page->remaining.fetch_add(1);
+        context.pool.spawn([links, begin, end] { links(begin, end); });
+    }
+    links(0, std::min(chunk, count));
+}
 
-        getFile(target, sessionFolder, HTML);
-        for (int i = 0; i < css.size(); i++)
+void fetchWorker(Frontier &frontier, ParseContext &context, StageStats &stats, Storage &storage)
+{
+    CrawlTask task;
+    while (frontier.pop(task))
+    {
+        std::string filename;
+        long status = 0;
         {
-            strncpy(target.data, css[i].c_str(), sizeof(target.data) - 1);
-            target.data[sizeof(target.data) - 1] = '\0';
-            getFile(target, sessionFolder, CSS);
+            StageTimer timer(stats);
+            const char *url = frontier.urls.get(task.url).data();
+            if (task.type == PAGE || task.type == FRAME || task.type == REFRESH)
+                std::cout << "Crawling: " << url << " (Depth: " << task.depth << ")\n";
+            auto started = std::chrono::steady_clock::now();
+            filename = getFile(url, storage, fileType(task.type), &status);
+            frontier.fetchDone(task, started);
         }
-        for (int i = 0; i < js.size(); i++)
+
+        bool parseable = fileType(task.type) == HTML || task.type == STYLESHEET;
+        if (filename.empty() || !parseable)
         {
-            strncpy(target.data, js[i].c_str(), sizeof(target.data) - 1);
-            target.data[sizeof(target.data) - 1] = '\0';
-            getFile(target, sessionFolder, CSS);
+            frontier.finish(task);
+            continue;
+        }
+        // Blocks while the parsers are behind
+        FetchedTask fetched{task, std::move(filename), status};
+        context.pool.submit([&context, fetched] { parsePage(context, fetched); });
+    }
+}
+
+// Fetching and parsing run as separate stages: fetch workers save pages and
+// submit them as tasks to a work-stealing parse pool, whose tasks feed
+// discovered URLs back into the frontier.
+void crawl(const std::string &startURL, int depth, UrlTable &urls, Storage &storage, const PipelineConfig &config)
+{
+    Frontier frontier(urls, storage.folder, config);
+    TrapDetector traps(config.traps);
+    traps.openLog(storage.folder + "/traps.log");
+    ParamLearner params;
+    if (!config.paramRules.empty() && !params.load(config.paramRules))
+        std::cerr << "Skipped the unreadable lines of " << config.paramRules << "; the file is rewritten after the crawl\n";
+    frontier.sameSite = config.sameSite;
+    frontier.siteBudget = config.siteBudget;
+    StageStats fetchStats("fetch", config.fetchThreads);
+    StageStats parseStats("parse", config.parseThreads);
+    WorkStealingPool pool(config.parseThreads, config.parseQueueDepth);
+    ParseContext context{frontier, pool, parseStats, traps, params, depth, config};
+    auto start = std::chrono::steady_clock::now();
+
+    UrlComponents startParts;
+    if (!parseUrl(startURL, startParts) || !isCrawlableScheme(startParts.scheme(startURL)))
+    {
+        std::cerr << "Not a crawlable URL: " << startURL << "\n";
+        return;
+    }
+    // A crawl of the same start URL that did not finish left a checkpoint in
+    // the session folder; it is restored before anything else is interned, so
+    // URL IDs come back as they were
+    bool checkpointing = config.checkpointInterval.count() > 0;
+    Checkpoint<CrawlTask> log(storage.folder + "/checkpoint");
+    bool resumed = false;
+    if (checkpointing && log.exists())
+    {
+        auto restoreStart = std::chrono::steady_clock::now();
+        if (!frontier.restore(log))
+        {
+            std::cerr << "Could not resume from " << storage.folder << "/checkpoint; remove it to start over\n";
+            return;
         }
+        auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - restoreStart);
+        if (frontier.pending == 0)
+        {
+            std::cout << "Checkpoint in " << storage.folder << " has nothing left to crawl\n";
+            log.remove();
+            return;
+        }
+        std::cout << "Resumed from checkpoint in " << took.count() << " ms: " << log.urlCount() << " urls, "
+                  << log.completedCount() << " completed, " << frontier.pending << " queued again\n";
+        resumed = true;
+    }
+    std::vector<CrawlTask> seed;
+    std::string canonical;
+    discover(seed, urls, traps, params, startURL, startParts, 0, PAGE, 0, config.canon, canonical);
+    if (!seed.empty())
+        frontier.homeSite = seed[0].site;
+    frontier.journaling = checkpointing;
+    if (!resumed)
+        frontier.push(seed);
 
-        for (const auto &link : hrefs)
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.fetchThreads; i++)
+        workers.emplace_back(fetchWorker, std::ref(frontier), std::ref(context), std::ref(fetchStats), std::ref(storage));
+
+    auto report = [&](bool final)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        printStage(std::cout, fetchStats, elapsed);
+        std::cout << "parse pool: " << pool.workers() << " workers, " << pool.waiting() << "/" << pool.injectLimit
+                  << " pages waiting (peak " << pool.maxInjected << "), " << pool.spawned << " link tasks spawned, "
+                  << pool.stolen << " stolen; fetchers blocked " << pool.blockedNanos / 1000000 << " ms\n";
+        printStage(std::cout, parseStats, elapsed);
         {
-            std::string absoluteLink = makeAbsoluteURL(currentURL, link);
+            std::lock_guard<std::mutex> lock(frontier.mutex);
+            std::cout << "frontier: " << frontier.queued() << " queued (peak " << frontier.peakQueued << ", "
+                      << frontier.peakQueued * sizeof(CrawlTask) / 1024 << " KiB), " << frontier.duplicates
+                      << " duplicates dropped, " << frontier.respelledDuplicates << " of them only after canonicalization";
+            if (frontier.queue.segmentCount())
+                std::cout << ", " << frontier.queue.segmentCount() << " segments on disk";
+            if (frontier.requeued)
+                std::cout << ", " << frontier.requeued << " requeued with a higher score (" << frontier.stale << " stale copies skipped)";
+            std::cout << "\n";
+            if (checkpointing)
+            {
+                log.report(std::cout);
+                std::cout << "  last checkpoint held the frontier lock "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(frontier.checkpointLocked).count() << " us\n";
+            }
+            std::cout << "sites: " << frontier.siteFetches.size() << " fetched from";
+            if (frontier.sameSite)
+                std::cout << ", " << frontier.offSite << " off-site links dropped";
+            if (frontier.siteBudget)
+                std::cout << ", " << frontier.overBudget << " urls over the budget of " << frontier.siteBudget;
+            std::cout << "\n";
+            double idle = std::chrono::duration<double>(frontier.idle).count();
+            std::cout << "hosts: " << frontier.hosts.queues() << " back queues, " << frontier.hosts.active() << " in use, "
+                      << frontier.hosts.fetching() << " fetching; fetchers idle " << static_cast<long>(idle * 1000) << " ms ("
+                      << static_cast<int>(100 * idle / (std::chrono::duration<double>(elapsed).count() * config.fetchThreads))
+                      << "%)\n";
+            frontier.hosts.report(std::cout, final, [&](uint64_t host)
+                                  {
+                                      auto sample = frontier.hostUrls.find(host);
+                                      if (sample == frontier.hostUrls.end())
+                                          return std::string("?");
+                                      std::string_view url = urls.get(sample->second);
+                                      UrlComponents parts;
+                                      return parseUrl(url, parts) ? std::string(parts.host(url)) : std::string(url);
+                                  });
+            if (!frontier.interest.empty() && frontier.fetches)
+                std::cout << "interest: " << frontier.interesting << " of " << frontier.fetches << " fetches ("
+                          << frontier.interesting * 1000 / frontier.fetches << " per 1000), "
+                          << frontier.interestingFirst1000 << " in the first 1000\n";
+        }
+        // Outside the frontier lock: a DRUM merge takes the two the other way round
+        if (frontier.seen)
+            frontier.seen->report(std::cout, std::chrono::duration<double>(elapsed).count());
+        else
+            frontier.drum->report(std::cout);
+        size_t known = urls.size();
+        size_t bytes = urls.memoryBytes();
+        std::cout << "url table: " << known << " urls, " << bytes / 1024 << " KiB";
+        if (known)
+            std::cout << " (" << bytes / known << " bytes per url)";
+        std::cout << "\n";
+        traps.report(std::cout);
+        params.report(std::cout, final);
+        config.scope.report(std::cout, final);
+    };
 
-            if (!absoluteLink.empty() && visited.find(absoluteLink) == visited.end())
+    {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point nextReport = Clock::now() + std::chrono::seconds(5);
+        Clock::time_point nextCheckpoint = Clock::now() + config.checkpointInterval;
+        std::unique_lock<std::mutex> lock(frontier.mutex);
+        while (!frontier.ready.wait_until(lock, checkpointing ? std::min(nextReport, nextCheckpoint) : nextReport,
+                                          [&] { return frontier.done; }))
+        {
+            lock.unlock();
+            // Written from here, while the fetchers carry on
+            if (checkpointing && Clock::now() >= nextCheckpoint)
             {
-                queue.push({absoluteLink, currentDepth + 1});
+                frontier.checkpoint(log);
+                nextCheckpoint = Clock::now() + config.checkpointInterval;
             }
+            if (Clock::now() >= nextReport)
+            {
+                report(false);
+                nextReport = Clock::now() + std::chrono::seconds(5);
+            }
+            lock.lock();
         }
     }
+    for (auto &worker : workers)
+        worker.join();
+    pool.close();
+    report(true);
+    // Nothing left to resume
+    if (checkpointing)
+        log.remove();
+    if (!config.paramRules.empty())
+        params.save(config.paramRules);
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    URL target;
+    std::string target;
     std::cout << "Enter URL to start crawling: ";
-    // std::cin >> target.data;
-    strcpy(target.data, "https://quotes.toscrape.com/");
+    // std::cin >> target;
+    target = "https://quotes.toscrape.com/";
     int depth;
     std::cout << "Enter crawl depth: ";
     // std::cin >> depth;
     depth = 0;
-    std::set<std::string> visited;
+
+    // Web_Crawler [--scope file] [--same-site] [--site-budget n] [--drum] [--interest text] [--host-delay ms] [--per-host n]
+    //             [--parse-threads n] [--checkpoint-every s] [url [depth]]
+    // overrides the defaults above
+    std::vector<std::string> args;
+    std::string scopeFile;
+    bool sameSite = false;
+    size_t siteBudget = 0;
+    bool drum = false;
+    std::string interest;
+    long hostDelay = 0;
+    size_t perHost = 0;
+    int parseThreads = 0;
+    long checkpointEvery = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--scope" && i + 1 < argc)
+            scopeFile = argv[++i];
+        else if (std::string(argv[i]) == "--same-site")
+            sameSite = true;
+        else if (std::string(argv[i]) == "--site-budget" && i + 1 < argc)
+            siteBudget = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::string(argv[i]) == "--drum")
+            drum = true;
+        else if (std::string(argv[i]) == "--interest" && i + 1 < argc)
+            interest = argv[++i];
+        else if (std::string(argv[i]) == "--host-delay" && i + 1 < argc)
+            hostDelay = std::strtol(argv[++i], nullptr, 10);
+        else if (std::string(argv[i]) == "--per-host" && i + 1 < argc)
+            perHost = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::string(argv[i]) == "--parse-threads" && i + 1 < argc)
+            parseThreads = std::atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--checkpoint-every" && i + 1 < argc)
+            checkpointEvery = std::strtol(argv[++i], nullptr, 10);
+        else
+            args.push_back(argv[i]);
+    }
+    bool reparseOnly = !args.empty() && args[0] == "--reparse";
+    if (!args.empty() && !reparseOnly)
+    {
+        target = args[0];
+        if (args.size() > 1)
+            depth = std::atoi(args[1].c_str());
+    }
+    UrlTable urls;
 
     // Remove restricted characters from the URL
-    std::string safeName = sanitize(target.data);
+    std::string targetHash = hashURL(target);
+    if (targetHash.empty())
+    {
+        std::cerr << "Error: Unable to hash the start URL " << target << ".\n";
+        return 1;
+    }
+    std::string safeName = boundedName(target, targetHash);
     std::string sessionFolder = "storage/" + safeName;
-    std::filesystem::create_directory(sessionFolder);
+
+#ifdef COUNT_ALLOCATIONS
+    xmlMemSetup(free, countingMalloc, countingRealloc, countingStrdup);
+#endif
+    xmlInitParser();
+    // libcurl converts internationalized host names through the locale
+    setlocale(LC_CTYPE, "C.UTF-8");
+
+    // Reprocess the stored pages only, optionally under another folder
+    if (reparseOnly)
+    {
+        reparse(args.size() > 1 ? args[1] : sessionFolder, target);
+        xmlCleanupParser();
+        return 0;
+    }
+
+    PipelineConfig config;
+    config.sameSite = sameSite;
+    config.siteBudget = siteBudget;
+    config.drum = drum;
+    config.interest = interest;
+    config.politeness.hostDelay = std::chrono::milliseconds(hostDelay);
+    config.politeness.perHost = perHost;
+    if (parseThreads > 0)
+        config.parseThreads = parseThreads;
+    if (checkpointEvery >= 0)
+        config.checkpointInterval = std::chrono::seconds(checkpointEvery);
+    config.paramRules = "storage/learned_params.txt";
+    if (!scopeFile.empty() && !config.scope.load(scopeFile))
+    {
+        xmlCleanupParser();
+        return 1;
+    }
 
     // Initialize cURL globally
     curl_global_init(CURL_GLOBAL_ALL);
 
+    Storage storage(sessionFolder);
+
     // Start crawling
-    crawl(target, depth, visited, sessionFolder);
+    crawl(target, depth, urls, storage, config);
 
     // Cleanup cURL globally
     curl_global_cleanup();
+    xmlCleanupParser();
 
     std::cout << "All pages saved in folder: " << sessionFolder << "\n";
     // TODO Add host
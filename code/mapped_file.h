@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a stored file. The pages are handed to the parser
+// directly, so reparsing an archived page never copies it into a buffer.
+struct MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string &filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                // Pages are parsed front to back exactly once
+                madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(mapping);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool valid() const { return data != nullptr; }
+};
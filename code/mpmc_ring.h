@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+// Bounded lock-free multi-producer multi-consumer ring, after DPDK's
+// rte_ring in its relaxed tail sync mode. Producers and consumers each have a
+// head and a tail cursor on a cache line of their own:
+//
+//   - push() claims a run of slots by moving the producer head with one
+//     compare-and-swap, copies its items in, then counts itself done on the
+//     producer tail;
+//   - pop() does the same with the consumer cursors, and may only read up to
+//     the producer tail.
+//
+// A cursor is a position and a count of claims. Whoever finishes last, when
+// the tail's count catches up with the head's, moves the tail position up to
+// the head, so no thread ever waits for another to finish its copy; a thread
+// descheduled mid-copy only delays when its side's items become visible. Heads
+// stay at most a quarter of the ring ahead of their tails, so that delay stays
+// bounded under constant traffic.
+//
+// A batch of any size costs one compare-and-swap on each cursor, and the slots
+// are contiguous, so a batch is a plain copy. Items are copied as bytes, so
+// they must be trivially copyable.
+template <typename T>
+class MpmcRing
+{
+    static_assert(std::is_trivially_copyable<T>::value, "slots are copied as bytes");
+
+public:
+    // Room for capacity items, rounded up to a power of two, at most 2^30
+    explicit MpmcRing(size_t capacity)
+    {
+        uint32_t size = 1;
+        while (size < capacity && size < (uint32_t(1) << 30))
+            size *= 2;
+        mask = size - 1;
+        lead = std::max<uint32_t>(size / 4, 1);
+        slots.reset(new T[size]);
+    }
+
+    MpmcRing(const MpmcRing &) = delete;
+    MpmcRing &operator=(const MpmcRing &) = delete;
+
+    // Adds as many of the count items as there is room for, in order.
+    // Returns how many that was.
+    size_t push(const T *items, size_t count)
+    {
+        uint32_t position;
+        uint32_t taken = claim(producer, consumer, mask + 1, count, position);
+        if (taken == 0)
+            return 0;
+        uint32_t first = position & mask;
+        uint32_t wrapped = std::min(taken, mask + 1 - first);
+        std::copy(items, items + wrapped, &slots[first]);
+        std::copy(items + wrapped, items + taken, &slots[0]);
+        done(producer);
+        return taken;
+    }
+
+    // Takes up to max of the oldest items. Returns how many it took.
+    size_t pop(T *items, size_t max)
+    {
+        uint32_t position;
+        uint32_t count = claim(consumer, producer, 0, max, position);
+        if (count == 0)
+            return 0;
+        uint32_t first = position & mask;
+        uint32_t wrapped = std::min(count, mask + 1 - first);
+        std::copy(&slots[first], &slots[first] + wrapped, items);
+        std::copy(&slots[0], &slots[0] + (count - wrapped), items + wrapped);
+        done(consumer);
+        return count;
+    }
+
+    bool push(const T &item) { return push(&item, 1) == 1; }
+    bool pop(T &item) { return pop(&item, 1) == 1; }
+
+    // Items published and not yet claimed; a snapshot that may be stale
+    size_t size() const
+    {
+        uint32_t tail = unpack(producer.tail.load(std::memory_order_acquire)).position;
+        uint32_t head = unpack(consumer.head.load(std::memory_order_acquire)).position;
+        int32_t count = static_cast<int32_t>(tail - head);
+        return count > 0 ? count : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mask + 1; }
+
+    // Position after every slot push() has claimed so far. Once published()
+    // says so for it, everything those pushes added is visible to pop().
+    uint32_t pushMark() const { return unpack(producer.head.load(std::memory_order_acquire)).position; }
+    bool published(uint32_t mark) const
+    {
+        uint32_t tail = unpack(producer.tail.load(std::memory_order_acquire)).position;
+        return static_cast<int32_t>(tail - mark) >= 0;
+    }
+
+private:
+    // Position and claim count packed into one word, so both change together
+    struct Mark
+    {
+        uint32_t position;
+        uint32_t claims;
+    };
+
+    static uint64_t pack(Mark mark) { return uint64_t(mark.claims) << 32 | mark.position; }
+    static Mark unpack(uint64_t word) { return {static_cast<uint32_t>(word), static_cast<uint32_t>(word >> 32)}; }
+
+    struct alignas(64) Cursor
+    {
+        // Claimed up to head, published up to tail
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+    };
+
+    // Claims up to want slots on side, which may run up to the other side's
+    // tail plus offset. Sets position to the first and returns how many.
+    uint32_t claim(Cursor &side, const Cursor &other, uint32_t offset, size_t want, uint32_t &position)
+    {
+        uint64_t head = side.head.load(std::memory_order_acquire);
+        while (true)
+        {
+            Mark mark = unpack(head);
+            uint32_t tail = unpack(side.tail.load(std::memory_order_acquire)).position;
+            if (static_cast<int32_t>(mark.position - tail) > static_cast<int32_t>(lead))
+            {
+                // Too far ahead of the last threads to finish; let them
+                std::this_thread::yield();
+                head = side.head.load(std::memory_order_acquire);
+                continue;
+            }
+            uint32_t limit = unpack(other.tail.load(std::memory_order_acquire)).position + offset;
+            uint32_t count = static_cast<uint32_t>(std::min<size_t>(want, limit - mark.position));
+            if (count == 0)
+                return 0;
+            if (side.head.compare_exchange_weak(head, pack({mark.position + count, mark.claims + 1}),
+                                                std::memory_order_acquire, std::memory_order_acquire))
+            {
+                position = mark.position;
+                return count;
+            }
+        }
+    }
+
+    // Counts one claim on side finished; the last one out publishes them all
+    static void done(Cursor &side)
+    {
+        uint64_t tail = side.tail.load(std::memory_order_acquire);
+        uint64_t next;
+        do
+        {
+            Mark head = unpack(side.head.load(std::memory_order_acquire));
+            Mark mark = unpack(tail);
+            mark.claims++;
+            if (mark.claims == head.claims)
+                mark.position = head.position;
+            next = pack(mark);
+        } while (!side.tail.compare_exchange_weak(tail, next, std::memory_order_release, std::memory_order_acquire));
+    }
+
+    Cursor producer;
+    Cursor consumer;
+    std::unique_ptr<T[]> slots;
+    uint32_t mask;
+    // How far a head may run ahead of its tail
+    uint32_t lead;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Per-stage counters. Utilization is the share of the stage's thread time
+// spent doing work rather than waiting for input.
+struct StageStats
+{
+    const char *name;
+    int threads;
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> busyNanos{0};
+
+    StageStats(const char *name, int threads) : name(name), threads(threads) {}
+
+    double utilization(std::chrono::steady_clock::duration elapsed) const
+    {
+        double available = std::chrono::duration<double, std::nano>(elapsed).count() * threads;
+        return available > 0 ? busyNanos.load() / available : 0.0;
+    }
+};
+
+// Measures one unit of work for a stage
+class StageTimer
+{
+public:
+    explicit StageTimer(StageStats &stats) : stats(stats), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer()
+    {
+        stats.busyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats.items++;
+    }
+
+private:
+    StageStats &stats;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline void printStage(std::ostream &out, const StageStats &stats, std::chrono::steady_clock::duration elapsed)
+{
+    out << stats.name << ": " << stats.threads << " threads, " << stats.items << " items, "
+        << static_cast<int>(stats.utilization(elapsed) * 100) << "% busy\n";
+}
@@ -0,0 +1,321 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Back half of a Mercator frontier (Heydon and Najork, "Mercator: A
+// scalable, extensible web crawler").
+//
+// A fixed set of back queues each holds the waiting records of one host name,
+// best score first, equal scores in the order they were added. A
+// min-heap orders the hosts with waiting records by the time they may next be
+// fetched from, and take() only hands out records of a host whose time has
+// come. A host with perHost fetches in flight is out of the heap until
+// finish() reports one done and sets its next time: hostDelay after the fetch
+// started, or delayFactor times as long as it took, whichever is later. Below
+// that it goes back in hostDelay after the fetch it just handed out. So no
+// worker queues up behind a slow host, and with no delay set the queues only
+// order the work.
+//
+// A back queue that runs empty is given to the next host that turns up. The
+// caller fills the queues from its front queue in priority order and stops at
+// the first record accepts() turns down, so a slow host holds up the others
+// only once it has backQueueDepth records waiting. Not synchronised; callers
+// lock around it.
+struct PolitenessOptions
+{
+    // Back queues, 0 for three per fetch worker as Mercator suggests
+    size_t backQueues = 0;
+    // Records a back queue takes before its host's further URLs stay in front
+    size_t backQueueDepth = 4096;
+    std::chrono::milliseconds hostDelay{0};
+    double delayFactor = 0;
+    // Fetches in flight per host, 0 for one with a delay set and no limit
+    // without
+    size_t perHost = 0;
+};
+
+template <typename Record>
+class HostQueues
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    HostQueues(size_t count, PolitenessOptions options) : options(options), backs(std::max<size_t>(count, 1))
+    {
+        limit = options.perHost;
+        if (limit == 0)
+            limit = options.hostDelay.count() > 0 || options.delayFactor > 0 ? 1 : SIZE_MAX;
+        for (size_t i = backs.size(); i-- > 0;)
+            unused.push_back(i);
+    }
+
+    // True if add() can take a record of host now
+    bool accepts(uint64_t host) const
+    {
+        auto assigned = owners.find(host);
+        if (assigned == owners.end())
+            return !unused.empty();
+        return backs[assigned->second].records.size() < options.backQueueDepth;
+    }
+
+    void add(uint64_t host, const Record &record, int64_t score)
+    {
+        auto assigned = owners.find(host);
+        size_t index;
+        if (assigned != owners.end())
+            index = assigned->second;
+        else
+        {
+            index = unused.back();
+            unused.pop_back();
+            owners[host] = index;
+            backs[index].host = host;
+            backs[index].fetching = 0;
+        }
+        Back &back = backs[index];
+        back.records.push_back({score, sequence++, record});
+        std::push_heap(back.records.begin(), back.records.end(), after);
+        count++;
+        // A host that comes back keeps the time it was given last
+        if (!back.scheduled && back.fetching < limit)
+            schedule(index, nextOf(host));
+    }
+
+    // Takes the next record of a host that is ready at now, and counts a fetch
+    // of the host in flight. Otherwise returns false and sets next to the earliest time a waiting
+    // host will be ready, or Clock::time_point::max() if none is waiting.
+    bool take(Clock::time_point now, Record &record, uint64_t &host, Clock::time_point &next)
+    {
+        while (true)
+        {
+            if (ready.empty())
+            {
+                next = Clock::time_point::max();
+                return false;
+            }
+            if (ready.top().first > now)
+            {
+                next = ready.top().first;
+                return false;
+            }
+            size_t index = ready.top().second;
+            ready.pop();
+            Back &back = backs[index];
+            back.scheduled = false;
+            // Went back in before a fetch still in flight pushed its time out
+            Clock::time_point due = nextOf(back.host);
+            if (due > now)
+            {
+                schedule(index, due);
+                continue;
+            }
+            std::pop_heap(back.records.begin(), back.records.end(), after);
+            record = back.records.back().record;
+            back.records.pop_back();
+            count--;
+            back.fetching++;
+            host = back.host;
+            if (back.fetching < limit && !back.records.empty())
+                schedule(index, now + options.hostDelay);
+            return true;
+        }
+    }
+
+    // Returns a host checked out by take() whose record was not fetched after
+    // all; it is ready again straight away
+    void putBack(uint64_t host)
+    {
+        auto assigned = owners.find(host);
+        if (assigned == owners.end())
+            return;
+        release(assigned->second, nextOf(host));
+    }
+
+    // Returns a host checked out by take() after a fetch between started and
+    // finished
+    void finish(uint64_t host, Clock::time_point started, Clock::time_point finished)
+    {
+        Host &stats = hosts[host];
+        if (stats.fetches)
+        {
+            // Fetches in flight together may finish out of order
+            auto gap = started > stats.lastStart ? started - stats.lastStart : stats.lastStart - started;
+            stats.gapTotal += gap;
+            stats.gapMin = stats.fetches == 1 ? gap : std::min(stats.gapMin, gap);
+        }
+        stats.fetches++;
+        stats.lastStart = std::max(stats.lastStart, started);
+        auto delay = std::chrono::duration_cast<Clock::duration>((finished - started) * options.delayFactor);
+        // Another fetch in flight may have set it later already
+        stats.next = std::max({stats.next, started + options.hostDelay, finished + delay});
+
+        auto assigned = owners.find(host);
+        if (assigned != owners.end())
+            release(assigned->second, stats.next);
+    }
+
+    // How long each host must still wait before its next fetch, in
+    // nanoseconds, for a checkpoint
+    std::vector<std::pair<uint64_t, int64_t>> delays(Clock::time_point now) const
+    {
+        std::vector<std::pair<uint64_t, int64_t>> waits;
+        for (const auto &entry : hosts)
+        {
+            if (entry.second.next > now)
+                waits.emplace_back(entry.first,
+                                   std::chrono::duration_cast<std::chrono::nanoseconds>(entry.second.next - now).count());
+        }
+        return waits;
+    }
+
+    // Holds host back until at least until, as restored from a checkpoint
+    void delay(uint64_t host, Clock::time_point until)
+    {
+        Host &stats = hosts[host];
+        stats.next = std::max(stats.next, until);
+    }
+
+    // Records waiting in the back queues
+    size_t size() const { return count; }
+    size_t queues() const { return backs.size(); }
+    // Back queues assigned to a host, and the fetches in flight from them
+    size_t active() const { return owners.size(); }
+    size_t fetching() const
+    {
+        size_t busy = 0;
+        for (const auto &entry : owners)
+            busy += backs[entry.second].fetching;
+        return busy;
+    }
+
+    // Spacing between requests to the same host, overall and, with perHost,
+    // for the hosts fetched from most. name(host) spells a host out.
+    void report(std::ostream &out, bool perHost, const std::function<std::string(uint64_t)> &name) const
+    {
+        size_t repeats = 0;
+        Clock::duration total{0};
+        Clock::duration closest = Clock::duration::max();
+        for (const auto &entry : hosts)
+        {
+            if (entry.second.fetches < 2)
+                continue;
+            repeats += entry.second.fetches - 1;
+            total += entry.second.gapTotal;
+            closest = std::min(closest, entry.second.gapMin);
+        }
+        out << "spacing: " << hosts.size() << " hosts";
+        if (repeats)
+            out << ", " << repeats << " repeat requests " << milliseconds(total / repeats) << " ms apart on average, closest "
+                << milliseconds(closest) << " ms";
+        out << "\n";
+        if (!perHost)
+            return;
+        std::vector<std::pair<size_t, uint64_t>> busiest;
+        for (const auto &entry : hosts)
+            busiest.emplace_back(entry.second.fetches, entry.first);
+        size_t shown = std::min<size_t>(busiest.size(), 5);
+        std::partial_sort(busiest.begin(), busiest.begin() + shown, busiest.end(), std::greater<>());
+        for (size_t i = 0; i < shown; i++)
+        {
+            const Host &stats = hosts.at(busiest[i].second);
+            out << "  " << name(busiest[i].second) << ": " << stats.fetches << " fetches";
+            if (stats.fetches > 1)
+                out << ", " << milliseconds(stats.gapTotal / (stats.fetches - 1)) << " ms apart on average, closest "
+                    << milliseconds(stats.gapMin) << " ms";
+            out << "\n";
+        }
+    }
+
+private:
+    struct Entry
+    {
+        int64_t score;
+        uint64_t sequence;
+        Record record;
+    };
+
+    // Heap order: a comes out after b
+    static bool after(const Entry &a, const Entry &b)
+    {
+        return a.score < b.score || (a.score == b.score && a.sequence > b.sequence);
+    }
+
+    struct Back
+    {
+        uint64_t host = 0;
+        // A heap, see after()
+        std::vector<Entry> records;
+        // Records handed out by take() and not yet finished or put back
+        size_t fetching = 0;
+        // In the ready heap
+        bool scheduled = false;
+    };
+
+    // Per host, whether or not it holds a back queue now
+    struct Host
+    {
+        size_t fetches = 0;
+        Clock::time_point lastStart;
+        Clock::time_point next;
+        Clock::duration gapTotal{0};
+        Clock::duration gapMin{0};
+    };
+
+    static long milliseconds(Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    }
+
+    void schedule(size_t index, Clock::time_point at)
+    {
+        backs[index].scheduled = true;
+        ready.emplace(at, index);
+    }
+
+    Clock::time_point nextOf(uint64_t host) const
+    {
+        auto known = hosts.find(host);
+        return known == hosts.end() ? Clock::time_point() : known->second.next;
+    }
+
+    // Ends a fetch of the host of a back queue. The queue goes back in the
+    // heap, unless it is there already, or is free for another host once it
+    // has nothing left and nothing in flight.
+    void release(size_t index, Clock::time_point at)
+    {
+        Back &back = backs[index];
+        back.fetching--;
+        if (back.scheduled)
+            return;
+        if (!back.records.empty())
+            schedule(index, at);
+        else if (back.fetching == 0)
+        {
+            owners.erase(back.host);
+            unused.push_back(index);
+        }
+    }
+
+    PolitenessOptions options;
+    // Fetches in flight a host may have, see PolitenessOptions::perHost
+    size_t limit;
+    std::vector<Back> backs;
+    std::vector<size_t> unused;
+    // Back queue of each host that holds one
+    std::unordered_map<uint64_t, size_t> owners;
+    std::unordered_map<uint64_t, Host> hosts;
+    // Next fetch time and back queue, earliest first
+    std::priority_queue<std::pair<Clock::time_point, size_t>, std::vector<std::pair<Clock::time_point, size_t>>,
+                        std::greater<>>
+        ready;
+    size_t count = 0;
+    uint64_t sequence = 0;
+};
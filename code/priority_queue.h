@@ -0,0 +1,129 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "segmented_queue.h"
+
+// Max-priority queue of records with integer scores, for a frontier that
+// fetches the best URL first rather than the oldest.
+//
+// Up to capacity records live in a 4-ary heap: the children of slot i are
+// slots 4i+1 to 4i+4, side by side in memory, so a sift-down compares four
+// entries from neighbouring cache lines per level of a tree half as deep as a
+// binary heap. Equal scores come out in push order. Records pushed while the
+// heap is full wait in a SegmentedQueue on disk and move into the heap, oldest
+// first, as pops make room; ordering is by score within the heap's window.
+//
+// Not synchronised; callers lock around it.
+template <typename Record>
+class PriorityQueue
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "records are written to disk as bytes");
+
+public:
+    // Overflow segment files go into folder
+    PriorityQueue(std::string folder, size_t capacity, size_t segmentRecords = size_t(1) << 20)
+        : capacity(capacity), overflow(std::move(folder), segmentRecords)
+    {
+    }
+
+    void push(const Record &record, int64_t score)
+    {
+        Entry entry{score, sequence++, record};
+        if (heap.size() < capacity && overflow.empty())
+            siftUp(entry);
+        else
+            overflow.push(entry);
+    }
+
+    // Takes the record with the highest score. Returns false when empty.
+    bool pop(Record &record)
+    {
+        if (heap.empty())
+            return false;
+        record = heap.front().record;
+        Entry last = heap.back();
+        heap.pop_back();
+        if (!heap.empty())
+            siftDown(last);
+        Entry waiting;
+        if (heap.size() < capacity && overflow.pop(waiting))
+            siftUp(waiting);
+        return true;
+    }
+
+    // The record pop() would take next, and its score; the queue must not be
+    // empty
+    const Record &top() const { return heap.front().record; }
+    int64_t topScore() const { return heap.front().score; }
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size() + overflow.size(); }
+    // Overflow segments waiting on disk
+    size_t segmentCount() const { return overflow.segmentCount(); }
+
+private:
+    static constexpr size_t arity = 4;
+
+    struct Entry
+    {
+        int64_t score;
+        // Push order, breaking ties first come first served
+        uint64_t sequence;
+        Record record;
+    };
+
+    static bool before(const Entry &a, const Entry &b)
+    {
+        return a.score > b.score || (a.score == b.score && a.sequence < b.sequence);
+    }
+
+    // Adds entry at the end and moves it up to its place
+    void siftUp(const Entry &entry)
+    {
+        size_t slot = heap.size();
+        heap.emplace_back();
+        while (slot > 0)
+        {
+            size_t parent = (slot - 1) / arity;
+            if (!before(entry, heap[parent]))
+                break;
+            heap[slot] = heap[parent];
+            slot = parent;
+        }
+        heap[slot] = entry;
+    }
+
+    // Puts entry at the root, whose old entry is gone, and moves it down
+    void siftDown(const Entry &entry)
+    {
+        size_t slot = 0;
+        size_t count = heap.size();
+        while (true)
+        {
+            size_t first = slot * arity + 1;
+            if (first >= count)
+                break;
+            size_t best = first;
+            size_t end = std::min(first + arity, count);
+            for (size_t child = first + 1; child < end; child++)
+            {
+                if (before(heap[child], heap[best]))
+                    best = child;
+            }
+            if (!before(heap[best], entry))
+                break;
+            heap[slot] = heap[best];
+            slot = best;
+        }
+        heap[slot] = entry;
+    }
+
+    size_t capacity;
+    std::vector<Entry> heap;
+    SegmentedQueue<Entry> overflow;
+    uint64_t sequence = 0;
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+
+// Public suffix list lookups: the public suffix of a host ("co.uk") and its
+// registrable domain ("example.co.uk"), the unit a crawl treats as one site.
+//
+// The list is compiled by gen_public_suffix at build time into a trie over
+// reversed labels (public_suffix_table.h) whose edges sit in a hash table
+// keyed by (parent node, label). A lookup walks one edge per label of the
+// host and allocates nothing.
+enum pslflag
+{
+    PSL_RULE = 1,
+    PSL_EXCEPTION = 2,
+    PSL_WILDCARD = 4 // the node has a "*" child rule
+};
+
+struct PslNode
+{
+    uint32_t label; // offset into pslLabels
+    uint8_t length;
+    uint8_t flags;
+};
+
+struct PslEdge
+{
+    uint32_t parent;
+    uint32_t child;
+};
+
+#include "public_suffix_table.h"
+
+inline uint32_t pslSlot(uint32_t parent, uint32_t hash)
+{
+    return ((hash ^ (parent * 0x9e3779b9u)) * 0x85ebca6bu) >> (32 - pslSlotBits);
+}
+
+inline bool pslLabelEquals(std::string_view label, const PslNode &node)
+{
+    if (label.size() != node.length)
+        return false;
+    for (size_t i = 0; i < label.size(); i++)
+    {
+        unsigned char c = label[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != static_cast<unsigned char>(pslLabels[node.label + i]))
+            return false;
+    }
+    return true;
+}
+
+// Index of the child of parent labelled label, whose hash is given, or 0 (the
+// root) if there is none
+inline uint32_t pslChild(uint32_t parent, std::string_view label, uint32_t hash)
+{
+    constexpr uint32_t mask = (uint32_t(1) << pslSlotBits) - 1;
+    for (uint32_t slot = pslSlot(parent, hash);; slot = (slot + 1) & mask)
+    {
+        const PslEdge &edge = pslEdges[slot];
+        if (edge.parent == UINT32_MAX)
+            return 0;
+        if (edge.parent == parent && pslLabelEquals(label, pslNodes[edge.child]))
+            return edge.child;
+    }
+}
+
+// Number of trailing labels of host that form its public suffix. Hosts under
+// no rule fall back to the implicit "*" rule, i.e. their last label.
+inline size_t publicSuffixLabels(std::string_view host)
+{
+    size_t labels = 1, depth = 0;
+    uint32_t node = 0;
+    size_t end = host.size();
+    while (end > 0)
+    {
+        // Find the start of the label and hash it in the same backward scan;
+        // gen_public_suffix hashes labels last byte first to match
+        uint32_t hash = 2166136261u;
+        size_t start = end;
+        while (start > 0 && host[start - 1] != '.')
+        {
+            unsigned char c = host[--start];
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            hash = (hash ^ c) * 16777619u;
+        }
+
+        uint32_t child = pslChild(node, host.substr(start, end - start), hash);
+        // "!www.ck" under "*.ck": the suffix is the exception minus its label
+        if (child && (pslNodes[child].flags & PSL_EXCEPTION))
+            return depth;
+        if (pslNodes[node].flags & PSL_WILDCARD)
+            labels = std::max(labels, depth + 1);
+        if (!child)
+            break;
+        depth++;
+        if (pslNodes[child].flags & PSL_RULE)
+            labels = std::max(labels, depth);
+        node = child;
+        if (start == 0)
+            break;
+        end = start - 1;
+    }
+    return labels;
+}
+
+inline bool isIpLiteral(std::string_view host)
+{
+    if (host.empty())
+        return false;
+    if (host.front() == '[')
+        return true;
+    // Dotted IPv4, which has a numeric last label unlike any domain
+    if (host.back() < '0' || host.back() > '9')
+        return false;
+    size_t dot = host.rfind('.');
+    std::string_view last = dot == std::string_view::npos ? host : host.substr(dot + 1);
+    return std::all_of(last.begin(), last.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// The last count labels of host, or an empty view if it has fewer
+inline std::string_view lastLabels(std::string_view host, size_t count)
+{
+    size_t end = host.size();
+    for (size_t i = 1; i < count; i++)
+    {
+        size_t dot = end == 0 ? std::string_view::npos : host.rfind('.', end - 1);
+        if (dot == std::string_view::npos)
+            return {};
+        end = dot;
+    }
+    size_t dot = end == 0 ? std::string_view::npos : host.rfind('.', end - 1);
+    return dot == std::string_view::npos ? host : host.substr(dot + 1);
+}
+
+inline std::string_view publicSuffix(std::string_view host)
+{
+    while (!host.empty() && host.back() == '.')
+        host.remove_suffix(1);
+    if (isIpLiteral(host))
+        return {};
+    std::string_view suffix = lastLabels(host, publicSuffixLabels(host));
+    return suffix.empty() ? host : suffix;
+}
+
+// The public suffix plus one label. Empty when host is itself a public suffix;
+// IP literals are their own site.
+inline std::string_view registrableDomain(std::string_view host)
+{
+    while (!host.empty() && host.back() == '.')
+        host.remove_suffix(1);
+    if (host.empty() || isIpLiteral(host))
+        return host;
+    return lastLabels(host, publicSuffixLabels(host) + 1);
+}
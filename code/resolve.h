@@ -0,0 +1,197 @@
+#pragma once
+#include <cstring>
+#include <string_view>
+
+// The five components of a URI reference (RFC 3986 appendix B). A component
+// that is absent differs from one that is present but empty.
+struct UriParts
+{
+    std::string_view scheme;
+    std::string_view authority;
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
+    bool hasScheme = false;
+    bool hasAuthority = false;
+    bool hasQuery = false;
+    bool hasFragment = false;
+};
+
+inline bool isSchemeChar(char c, bool first)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        return true;
+    return !first && ((c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.');
+}
+
+inline UriParts splitUri(std::string_view uri)
+{
+    UriParts parts;
+    size_t pos = 0;
+    while (pos < uri.size() && isSchemeChar(uri[pos], pos == 0))
+        pos++;
+    if (pos > 0 && pos < uri.size() && uri[pos] == ':')
+    {
+        parts.scheme = uri.substr(0, pos);
+        parts.hasScheme = true;
+        uri.remove_prefix(pos + 1);
+    }
+
+    if (uri.size() >= 2 && uri[0] == '/' && uri[1] == '/')
+    {
+        size_t end = uri.find_first_of("/?#", 2);
+        if (end == std::string_view::npos)
+            end = uri.size();
+        parts.authority = uri.substr(2, end - 2);
+        parts.hasAuthority = true;
+        uri.remove_prefix(end);
+    }
+
+    size_t hash = uri.find('#');
+    if (hash != std::string_view::npos)
+    {
+        parts.fragment = uri.substr(hash + 1);
+        parts.hasFragment = true;
+        uri = uri.substr(0, hash);
+    }
+    size_t question = uri.find('?');
+    if (question != std::string_view::npos)
+    {
+        parts.query = uri.substr(question + 1);
+        parts.hasQuery = true;
+        uri = uri.substr(0, question);
+    }
+    parts.path = uri;
+    return parts;
+}
+
+// RFC 3986 section 5.2.4 done in place. The output never outgrows the input,
+// so the write position trails the read position. Returns the new length.
+inline size_t removeDotSegments(char *path, size_t size)
+{
+    size_t read = 0, write = 0;
+    auto rest = [&](const char *prefix, size_t n)
+    { return size - read >= n && memcmp(path + read, prefix, n) == 0; };
+    auto popSegment = [&]()
+    {
+        while (write > 0 && path[--write] != '/')
+            ;
+    };
+
+    while (read < size)
+    {
+        if (rest("../", 3))
+            read += 3;
+        else if (rest("./", 2) || rest("/./", 3))
+            read += 2;
+        else if (size - read == 2 && rest("/.", 2))
+        {
+            path[write++] = '/';
+            read = size;
+        }
+        else if (rest("/../", 4))
+        {
+            read += 3;
+            popSegment();
+        }
+        else if (size - read == 3 && rest("/..", 3))
+        {
+            popSegment();
+            path[write++] = '/';
+            read = size;
+        }
+        else if ((size - read == 1 && path[read] == '.') || (size - read == 2 && rest("..", 2)))
+            read = size;
+        else
+        {
+            // Move the first segment, with its leading '/', to the output
+            size_t end = read + 1;
+            while (end < size && path[end] != '/')
+                end++;
+            memmove(path + write, path + read, end - read);
+            write += end - read;
+            read = end;
+        }
+    }
+    return write;
+}
+
+// Upper bound on the length of resolveUri(base, reference)
+inline size_t maxResolvedSize(std::string_view base, std::string_view reference)
+{
+    return base.size() + reference.size() + 8;
+}
+
+// Resolves reference against an absolute base (RFC 3986 section 5.2) into out,
+// which must hold maxResolvedSize(base, reference) bytes. Nothing is
+// allocated. Returns the length written, or 0 when base has no scheme.
+inline size_t resolveUri(std::string_view base, std::string_view reference, char *out)
+{
+    UriParts b = splitUri(base);
+    if (!b.hasScheme)
+        return 0;
+    UriParts r = splitUri(reference);
+
+    size_t n = 0;
+    auto append = [&](std::string_view s)
+    {
+        memcpy(out + n, s.data(), s.size());
+        n += s.size();
+    };
+
+    std::string_view scheme = r.hasScheme ? r.scheme : b.scheme;
+    append(scheme);
+    out[n++] = ':';
+
+    bool hasAuthority = r.hasScheme || r.hasAuthority ? r.hasAuthority : b.hasAuthority;
+    if (hasAuthority)
+    {
+        append("//");
+        append(r.hasScheme || r.hasAuthority ? r.authority : b.authority);
+    }
+
+    std::string_view query;
+    bool hasQuery;
+    size_t pathStart = n;
+    if (r.hasScheme || r.hasAuthority || (!r.path.empty() && r.path[0] == '/'))
+    {
+        append(r.path);
+        n = pathStart + removeDotSegments(out + pathStart, n - pathStart);
+        query = r.query;
+        hasQuery = r.hasQuery;
+    }
+    else if (r.path.empty())
+    {
+        append(b.path);
+        query = r.hasQuery ? r.query : b.query;
+        hasQuery = r.hasQuery || b.hasQuery;
+    }
+    else
+    {
+        // Merge: the base path up to its last '/', then the reference path
+        if (b.hasAuthority && b.path.empty())
+            out[n++] = '/';
+        else
+        {
+            size_t slash = b.path.rfind('/');
+            if (slash != std::string_view::npos)
+                append(b.path.substr(0, slash + 1));
+        }
+        append(r.path);
+        n = pathStart + removeDotSegments(out + pathStart, n - pathStart);
+        query = r.query;
+        hasQuery = r.hasQuery;
+    }
+
+    if (hasQuery)
+    {
+        out[n++] = '?';
+        append(query);
+    }
+    if (r.hasFragment)
+    {
+        out[n++] = '#';
+        append(r.fragment);
+    }
+    return n;
+}
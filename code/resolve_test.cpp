@@ -0,0 +1,94 @@
+// Checks resolveUri() against the examples of RFC 3986 section 5.4. Built and
+// run by "make test".
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "resolve.h"
+
+struct Example
+{
+    const char *reference;
+    const char *expected;
+};
+
+// Section 5.4.1
+const Example normalExamples[] = {
+    {"g:h", "g:h"},
+    {"g", "http://a/b/c/g"},
+    {"./g", "http://a/b/c/g"},
+    {"g/", "http://a/b/c/g/"},
+    {"/g", "http://a/g"},
+    {"//g", "http://g"},
+    {"?y", "http://a/b/c/d;p?y"},
+    {"g?y", "http://a/b/c/g?y"},
+    {"#s", "http://a/b/c/d;p?q#s"},
+    {"g#s", "http://a/b/c/g#s"},
+    {"g?y#s", "http://a/b/c/g?y#s"},
+    {";x", "http://a/b/c/;x"},
+    {"g;x", "http://a/b/c/g;x"},
+    {"g;x?y#s", "http://a/b/c/g;x?y#s"},
+    {"", "http://a/b/c/d;p?q"},
+    {".", "http://a/b/c/"},
+    {"./", "http://a/b/c/"},
+    {"..", "http://a/b/"},
+    {"../", "http://a/b/"},
+    {"../g", "http://a/b/g"},
+    {"../..", "http://a/"},
+    {"../../", "http://a/"},
+    {"../../g", "http://a/g"},
+};
+
+// Section 5.4.2
+const Example abnormalExamples[] = {
+    {"../../../g", "http://a/g"},
+    {"../../../../g", "http://a/g"},
+    {"/./g", "http://a/g"},
+    {"/../g", "http://a/g"},
+    {"g.", "http://a/b/c/g."},
+    {".g", "http://a/b/c/.g"},
+    {"g..", "http://a/b/c/g.."},
+    {"..g", "http://a/b/c/..g"},
+    {"./../g", "http://a/b/g"},
+    {"./g/.", "http://a/b/c/g/"},
+    {"g/./h", "http://a/b/c/g/h"},
+    {"g/../h", "http://a/b/c/h"},
+    {"g;x=1/./y", "http://a/b/c/g;x=1/y"},
+    {"g;x=1/../y", "http://a/b/c/y"},
+    {"g?y/./x", "http://a/b/c/g?y/./x"},
+    {"g?y/../x", "http://a/b/c/g?y/../x"},
+    {"g#s/./x", "http://a/b/c/g#s/./x"},
+    {"g#s/../x", "http://a/b/c/g#s/../x"},
+    // Strict parsers keep the scheme
+    {"http:g", "http:g"},
+};
+
+int check(const Example *examples, size_t count, const char *section)
+{
+    const std::string base = "http://a/b/c/d;p?q";
+    int failures = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::vector<char> out(maxResolvedSize(base, examples[i].reference));
+        std::string resolved(out.data(), resolveUri(base, examples[i].reference, out.data()));
+        if (resolved != examples[i].expected)
+        {
+            std::printf("%s: \"%s\" resolved to \"%s\", expected \"%s\"\n", section, examples[i].reference,
+                        resolved.c_str(), examples[i].expected);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    int failures = check(normalExamples, sizeof(normalExamples) / sizeof(normalExamples[0]), "5.4.1") +
+                   check(abnormalExamples, sizeof(abnormalExamples) / sizeof(abnormalExamples[0]), "5.4.2");
+    if (failures)
+    {
+        std::printf("%d resolution examples failed\n", failures);
+        return 1;
+    }
+    std::printf("All RFC 3986 resolution examples pass\n");
+    return 0;
+}
@@ -0,0 +1,396 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "url_parse.h"
+
+// Include/exclude rules that decide which discovered URLs a crawl follows.
+// A scope file holds one rule per line, '#' starts a comment:
+//
+//   +host example.com      allow example.com and its subdomains
+//   -host ads.example.com  the longest matching host rule decides
+//   +path /docs/           path prefix; when any exist, one must match
+//   -path /private/
+//   -ext .zip              path suffix
+//   -query sessionid=      substring of the query
+//   -contains /calendar/   substring anywhere in the path or query
+//
+// Host rules are kept in a trie over the reversed host. Every other pattern
+// is compiled into one Aho-Corasick automaton, so a URL is checked in a single
+// pass over its path and query however many rules there are. Matching ignores
+// ASCII case.
+enum rulekind
+{
+    HOST_RULE,
+    PATH_RULE,
+    EXTENSION_RULE,
+    QUERY_RULE,
+    CONTAINS_RULE
+};
+
+struct ScopeRule
+{
+    bool include;
+    rulekind kind;
+    std::string pattern;
+};
+
+class ScopeFilter
+{
+public:
+    ScopeFilter() { compile(); }
+
+    ScopeFilter(const ScopeFilter &) = delete;
+    ScopeFilter &operator=(const ScopeFilter &) = delete;
+
+    // Adds a rule in scope file syntax and recompiles. Returns false if the
+    // line is not a rule.
+    bool addRule(std::string_view line)
+    {
+        if (!parseRule(line))
+            return false;
+        compile();
+        return true;
+    }
+
+    bool load(const std::string &filename)
+    {
+        std::ifstream file(filename);
+        if (!file)
+        {
+            std::cerr << "Could not open scope file: " << filename << "\n";
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        bool ok = true;
+        while (std::getline(file, line))
+        {
+            number++;
+            std::string_view rule = line.substr(0, line.find('#'));
+            while (!rule.empty() && isspace(static_cast<unsigned char>(rule.back())))
+                rule.remove_suffix(1);
+            while (!rule.empty() && isspace(static_cast<unsigned char>(rule.front())))
+                rule.remove_prefix(1);
+            if (!rule.empty() && !parseRule(rule))
+            {
+                std::cerr << filename << ":" << number << ": not a scope rule: " << line << "\n";
+                ok = false;
+            }
+        }
+        compile();
+        return ok;
+    }
+
+    bool empty() const { return rules.empty(); }
+
+    // Whether url, split by parseUrl(), is inside the crawl scope. Safe to call
+    // from any number of threads.
+    bool allows(std::string_view url, const UrlComponents &parts) const
+    {
+        if (rules.empty())
+        {
+            accepted.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        int hostRule = matchHost(parts.host(url));
+        if (hostRule >= 0 && !rules[hostRule].include)
+            return reject(hostRule);
+        if (hostRule < 0 && hasHostIncludes)
+            return reject(outsideHosts);
+
+        // One pass of the automaton over the path and query
+        bool pathIncluded = !hasPathIncludes;
+        uint32_t state = 0;
+        for (size_t i = parts.pathStart; i < parts.fragmentStart; i++)
+        {
+            state = delta[state * classCount + byteClass[static_cast<unsigned char>(url[i])]];
+            for (uint32_t o = outputStart[state]; o < outputStart[state + 1]; o++)
+            {
+                int index = outputs[o];
+                const ScopeRule &rule = rules[index];
+                size_t end = i + 1, start = end - rule.pattern.size();
+                bool hit = false;
+                switch (rule.kind)
+                {
+                case PATH_RULE:
+                    hit = start == parts.pathStart && end <= parts.queryStart;
+                    break;
+                case EXTENSION_RULE:
+                    hit = end == parts.queryStart;
+                    break;
+                case QUERY_RULE:
+                    hit = parts.hasQuery() && start > parts.queryStart;
+                    break;
+                case CONTAINS_RULE:
+                    hit = true;
+                    break;
+                case HOST_RULE:
+                    break;
+                }
+                if (!hit)
+                    continue;
+                if (!rule.include)
+                    return reject(index);
+                if (!pathIncluded)
+                {
+                    hits[index].fetch_add(1, std::memory_order_relaxed);
+                    pathIncluded = true;
+                }
+            }
+        }
+        if (!pathIncluded)
+            return reject(outsidePaths);
+        if (hostRule >= 0)
+            hits[hostRule].fetch_add(1, std::memory_order_relaxed);
+        accepted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Totals, and with perRule the hits of every rule
+    void report(std::ostream &out, bool perRule) const
+    {
+        if (rules.empty())
+            return;
+        out << "scope: " << accepted.load() << " accepted, " << rejected.load() << " rejected";
+        if (hasHostIncludes)
+            out << ", " << hits[outsideHosts].load() << " outside the allowed hosts";
+        if (hasPathIncludes)
+            out << ", " << hits[outsidePaths].load() << " outside the allowed paths";
+        out << "\n";
+        if (!perRule)
+            return;
+        static const char *const kinds[] = {"host", "path", "ext", "query", "contains"};
+        for (size_t i = 0; i < rules.size(); i++)
+            out << "  " << (rules[i].include ? '+' : '-') << kinds[rules[i].kind] << " " << rules[i].pattern << ": "
+                << hits[i].load() << " hits\n";
+    }
+
+private:
+    struct HostNode
+    {
+        std::vector<std::pair<char, uint32_t>> children;
+        int rule = -1;
+    };
+
+    static char lower(char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
+    bool parseRule(std::string_view line)
+    {
+        if (line.size() < 2 || (line[0] != '+' && line[0] != '-'))
+            return false;
+        bool include = line[0] == '+';
+        size_t space = line.find(' ');
+        if (space == std::string_view::npos)
+            return false;
+        std::string_view kind = line.substr(1, space - 1);
+        std::string_view pattern = line.substr(space + 1);
+        while (!pattern.empty() && pattern.front() == ' ')
+            pattern.remove_prefix(1);
+
+        ScopeRule rule{include, HOST_RULE, {}};
+        if (kind == "host")
+        {
+            while (!pattern.empty() && pattern.front() == '.')
+                pattern.remove_prefix(1);
+            while (!pattern.empty() && pattern.back() == '.')
+                pattern.remove_suffix(1);
+        }
+        else if (kind == "path")
+            rule.kind = PATH_RULE;
+        else if (kind == "ext")
+            rule.kind = EXTENSION_RULE;
+        else if (kind == "query")
+            rule.kind = QUERY_RULE;
+        else if (kind == "contains")
+            rule.kind = CONTAINS_RULE;
+        else
+            return false;
+        if (pattern.empty())
+            return false;
+        // Only host and path rules can include; the others only exclude
+        if (include && rule.kind != HOST_RULE && rule.kind != PATH_RULE)
+            return false;
+        for (char c : pattern)
+            rule.pattern += lower(c);
+        rules.push_back(std::move(rule));
+        return true;
+    }
+
+    void compile()
+    {
+        // Two extra counters after the rules for URLs no include rule matched
+        outsideHosts = rules.size();
+        outsidePaths = rules.size() + 1;
+        hits.reset(new std::atomic<uint64_t>[rules.size() + 2]());
+        hasHostIncludes = hasPathIncludes = false;
+
+        hostTrie.assign(1, HostNode());
+        for (size_t i = 0; i < rules.size(); i++)
+        {
+            if (rules[i].kind != HOST_RULE)
+                continue;
+            hasHostIncludes |= rules[i].include;
+            uint32_t node = 0;
+            const std::string &host = rules[i].pattern;
+            for (auto c = host.rbegin(); c != host.rend(); ++c)
+            {
+                uint32_t next = hostChild(node, *c);
+                if (!next)
+                {
+                    next = hostTrie.size();
+                    hostTrie[node].children.push_back({*c, next});
+                    hostTrie.emplace_back();
+                }
+                node = next;
+            }
+            hostTrie[node].rule = i;
+        }
+
+        // Bytes that occur in no pattern share class 0; upper case letters
+        // share the class of their lower case form. Patterns are stored in
+        // lower case, so at most 230 classes are ever needed.
+        byteClass.fill(0);
+        classCount = 1;
+        for (const auto &rule : rules)
+        {
+            if (rule.kind == HOST_RULE)
+                continue;
+            for (char c : rule.pattern)
+            {
+                unsigned char b = c;
+                if (!byteClass[b])
+                    byteClass[b] = classCount++;
+            }
+        }
+        for (int c = 'A'; c <= 'Z'; c++)
+            byteClass[c] = byteClass[c + ('a' - 'A')];
+
+        // Trie of the patterns, one dense row of transitions per state
+        std::vector<std::vector<int>> stateOutputs(1);
+        delta.assign(classCount, 0);
+        for (size_t i = 0; i < rules.size(); i++)
+        {
+            if (rules[i].kind == HOST_RULE)
+                continue;
+            hasPathIncludes |= rules[i].include;
+            uint32_t state = 0;
+            for (char c : rules[i].pattern)
+            {
+                uint32_t &next = delta[state * classCount + byteClass[static_cast<unsigned char>(c)]];
+                if (!next)
+                {
+                    next = stateOutputs.size();
+                    stateOutputs.emplace_back();
+                    delta.resize(delta.size() + classCount, 0);
+                }
+                state = delta[state * classCount + byteClass[static_cast<unsigned char>(c)]];
+            }
+            stateOutputs[state].push_back(i);
+        }
+
+        // Breadth first: failure links, missing transitions borrowed from the
+        // failure state, and outputs inherited along failure links
+        std::vector<uint32_t> fail(stateOutputs.size(), 0);
+        std::queue<uint32_t> pending;
+        for (uint32_t c = 0; c < classCount; c++)
+        {
+            if (delta[c])
+                pending.push(delta[c]);
+        }
+        while (!pending.empty())
+        {
+            uint32_t state = pending.front();
+            pending.pop();
+            const std::vector<int> &inherited = stateOutputs[fail[state]];
+            stateOutputs[state].insert(stateOutputs[state].end(), inherited.begin(), inherited.end());
+            for (uint32_t c = 0; c < classCount; c++)
+            {
+                uint32_t &next = delta[state * classCount + c];
+                uint32_t fallback = delta[fail[state] * classCount + c];
+                if (next)
+                {
+                    fail[next] = fallback;
+                    pending.push(next);
+                }
+                else
+                    next = fallback;
+            }
+        }
+
+        outputStart.assign(1, 0);
+        outputs.clear();
+        for (const auto &list : stateOutputs)
+        {
+            outputs.insert(outputs.end(), list.begin(), list.end());
+            outputStart.push_back(outputs.size());
+        }
+    }
+
+    // Child of a host trie node for c, or 0 (the root) if there is none
+    uint32_t hostChild(uint32_t node, char c) const
+    {
+        for (const auto &child : hostTrie[node].children)
+        {
+            if (child.first == c)
+                return child.second;
+        }
+        return 0;
+    }
+
+    // Index of the most specific host rule covering host, or -1
+    int matchHost(std::string_view host) const
+    {
+        while (!host.empty() && host.back() == '.')
+            host.remove_suffix(1);
+        int best = -1;
+        uint32_t node = 0;
+        for (size_t i = host.size(); i-- > 0;)
+        {
+            uint32_t next = hostChild(node, lower(host[i]));
+            if (!next)
+                break;
+            node = next;
+            // A rule covers whole labels only
+            if (hostTrie[node].rule >= 0 && (i == 0 || host[i - 1] == '.'))
+                best = hostTrie[node].rule;
+        }
+        return best;
+    }
+
+    bool reject(size_t counter) const
+    {
+        hits[counter].fetch_add(1, std::memory_order_relaxed);
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    std::vector<ScopeRule> rules;
+    bool hasHostIncludes = false;
+    bool hasPathIncludes = false;
+    size_t outsideHosts = 0;
+    size_t outsidePaths = 1;
+
+    std::vector<HostNode> hostTrie;
+
+    std::array<uint8_t, 256> byteClass;
+    uint32_t classCount = 1;
+    std::vector<uint32_t> delta;
+    std::vector<uint32_t> outputStart;
+    std::vector<int> outputs;
+
+    // Metrics only, hence mutable in a filter that is otherwise read only
+    // once the crawl starts
+    std::unique_ptr<std::atomic<uint64_t>[]> hits;
+    mutable std::atomic<uint64_t> accepted{0};
+    mutable std::atomic<uint64_t> rejected{0};
+};
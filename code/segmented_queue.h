@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+// FIFO queue that keeps only its two ends in memory, so a frontier can hold
+// far more entries than fit in RAM.
+//
+// Records are appended to an in-memory tail. A full tail is written out as
+// one append-only segment file of segmentRecords records. pop() reads from a
+// head that is either a segment mapped with mmap, oldest first, or, when no
+// segment is waiting, the former tail. A consumed segment is unmapped and its
+// file kept for the next spill instead of being deleted and created again.
+// Memory use is one tail of at most segmentRecords records, plus the page
+// cache behind the mapped head.
+//
+// Records are copied to disk as bytes, so they must be trivially copyable and
+// must not point into memory. Not synchronised; callers lock around it.
+template <typename Record>
+class SegmentedQueue
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "records are written to disk as bytes");
+
+public:
+    // Segment files go into folder, which is created and emptied of old ones
+    explicit SegmentedQueue(std::string folder, size_t segmentRecords = size_t(1) << 20)
+        : folder(std::move(folder)), segmentRecords(segmentRecords)
+    {
+        std::error_code error;
+        std::filesystem::remove_all(this->folder, error);
+        std::filesystem::create_directories(this->folder, error);
+    }
+
+    ~SegmentedQueue()
+    {
+        mapped.reset();
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+    }
+
+    SegmentedQueue(const SegmentedQueue &) = delete;
+    SegmentedQueue &operator=(const SegmentedQueue &) = delete;
+
+    void push(const Record &record)
+    {
+        tail.push_back(record);
+        count++;
+        if (tail.size() >= segmentRecords && !spillFailed)
+            spill();
+    }
+
+    // Takes the oldest record. Returns false when the queue is empty.
+    bool pop(Record &record)
+    {
+        if (headNext == headSize && !nextHead())
+            return false;
+        record = headData[headNext++];
+        count--;
+        return true;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    // Segments waiting on disk
+    size_t segmentCount() const { return segments.size(); }
+
+private:
+    // Writes the tail out as the newest segment. On failure the tail simply
+    // keeps growing in memory.
+    void spill()
+    {
+        std::string filename;
+        if (!recycled.empty())
+        {
+            filename = std::move(recycled.back());
+            recycled.pop_back();
+        }
+        else
+            filename = folder + "/segment-" + std::to_string(created++);
+
+        int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        const char *bytes = reinterpret_cast<const char *>(tail.data());
+        size_t remaining = tail.size() * sizeof(Record);
+        while (fd >= 0 && remaining > 0)
+        {
+            ssize_t written = write(fd, bytes, remaining);
+            if (written <= 0)
+                break;
+            bytes += written;
+            remaining -= written;
+        }
+        if (fd >= 0)
+            close(fd);
+        if (fd < 0 || remaining > 0)
+        {
+            std::cerr << "Could not write frontier segment " << filename << "; keeping the queue in memory\n";
+            spillFailed = true;
+            return;
+        }
+        segments.push_back({std::move(filename), tail.size()});
+        tail.clear();
+    }
+
+    // Moves the head to the oldest segment, or to the tail if there is none
+    bool nextHead()
+    {
+        if (mapped)
+        {
+            mapped.reset();
+            recycled.push_back(std::move(mappedName));
+        }
+        head.clear();
+        headData = nullptr;
+        headNext = headSize = 0;
+
+        if (!segments.empty())
+        {
+            Segment segment = std::move(segments.front());
+            segments.pop_front();
+            mapped.reset(new MappedFile(segment.filename));
+            if (!mapped->valid() || mapped->size < segment.records * sizeof(Record))
+            {
+                // Lost records cannot be recovered; skip them and carry on
+                std::cerr << "Could not map frontier segment " << segment.filename << "\n";
+                count -= segment.records;
+                mapped.reset();
+                return nextHead();
+            }
+            mappedName = std::move(segment.filename);
+            headData = reinterpret_cast<const Record *>(mapped->data);
+            headSize = segment.records;
+            return true;
+        }
+        if (tail.empty())
+            return false;
+        head.swap(tail);
+        headData = head.data();
+        headSize = head.size();
+        return true;
+    }
+
+    struct Segment
+    {
+        std::string filename;
+        size_t records;
+    };
+
+    std::string folder;
+    size_t segmentRecords;
+    std::vector<Record> tail;
+
+    // The head is either the mapped oldest segment or a former tail
+    std::unique_ptr<MappedFile> mapped;
+    std::string mappedName;
+    std::vector<Record> head;
+    const Record *headData = nullptr;
+    size_t headNext = 0;
+    size_t headSize = 0;
+
+    std::deque<Segment> segments;
+    std::vector<std::string> recycled;
+    size_t created = 0;
+    size_t count = 0;
+    bool spillFailed = false;
+};
@@ -0,0 +1,442 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "fingerprint.h"
+#include "url_parse.h"
+
+// Online detection of crawler traps: URL spaces that never run out, such as
+// calendars, session IDs and relative links that nest a path forever.
+//
+// URLs are grouped by pattern: host plus the path with every digit run
+// replaced by '#', so /cal/2024/05/12 and /cal/1999/01/02 share one. A
+// pattern is quarantined (no more new URLs from it) when:
+//   - its path repeats a segment sequence or nests too deep; once a directory
+//     has produced several such URLs, everything below it is quarantined,
+//     since relative links that nest forever rarely repeat exactly;
+//   - it produced more distinct URLs than a pattern reasonably has;
+//   - several of its pages came back with near-identical content.
+// A (path, query parameter) pair whose parameter takes too many distinct
+// values has its further values dropped. A host producing far more new URLs
+// than it has pages fetched is throttled: its patterns get a much smaller
+// URL allowance.
+//
+// Counts alone do not tell a trap from a catalogue: /product.php?id= takes as
+// many values as there are products. So the tight limits apply only once a
+// pattern, or for throttling its host, has returned near-identical pages,
+// which is what a calendar or a session ID space serves; everything else
+// only meets loose limits meant as a backstop. Assets link nowhere and are
+// never counted.
+//
+// Every decision is written once to the trap log with an example URL.
+struct TrapOptions
+{
+    size_t maxPathSegments = 24;
+    // A run of 1 to 4 segments repeated this many times back to back
+    size_t maxSequenceRepeats = 3;
+    // Looping or too deep URLs below one directory before all of it goes
+    size_t maxLoopUrls = 10;
+    // Distinct URLs of a pattern, and distinct values of one of its query
+    // parameters: the suspect limits once the pattern has returned
+    // suspectPages near-identical pages, the max ones always
+    size_t suspectPatternUrls = 1000;
+    size_t suspectParameterValues = 100;
+    size_t maxPatternUrls = 1000000;
+    size_t maxParameterValues = 1000000;
+    size_t suspectPages = 2;
+    // Host throttling, for hosts with suspectPages near-identical pages: new
+    // URLs per fetched page, once enough pages are in
+    double maxHostGrowth = 40.0;
+    size_t minHostPages = 20;
+    size_t throttledPatternUrls = 50;
+    // Pages within maxSimhashDistance bits of each other count as the same
+    int maxSimhashDistance = 3;
+    size_t maxDuplicatePages = 5;
+};
+
+enum trapreason
+{
+    REPEATED_SEGMENTS,
+    DEEP_PATH,
+    PATTERN_GROWTH,
+    PARAMETER_VALUES,
+    HOST_GROWTH,
+    DUPLICATE_CONTENT
+};
+
+inline bool isWordChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           static_cast<unsigned char>(c) >= 0x80;
+}
+
+// 64-bit SimHash of an HTML page over the set of its distinct features: the
+// words of its text and the quoted attribute values of its tags. Counting each
+// feature once keeps repeated boilerplate from outweighing the links, so pages
+// that share a template but link to different places stay apart, while pages
+// that differ only in a date or a counter land a few bits from each other.
+// With textHash, the words of the text in order are also hashed into it.
+inline uint64_t pageSimhash(const char *data, size_t size, uint64_t *textHash = nullptr)
+{
+    // Reused between calls; one hash per word of the page
+    thread_local std::vector<uint64_t> features;
+    features.clear();
+    uint64_t text = 0;
+
+    bool inTag = false;
+    for (size_t i = 0; i < size;)
+    {
+        char c = data[i];
+        if (inTag && (c == '"' || c == '\''))
+        {
+            const char *close = static_cast<const char *>(memchr(data + i + 1, c, size - i - 1));
+            size_t end = close ? close - data : size;
+            features.push_back(fingerprint64(std::string_view(data + i + 1, end - i - 1)));
+            i = end + 1;
+        }
+        else if (inTag || !isWordChar(c))
+        {
+            if (c == '<' || c == '>')
+                inTag = c == '<';
+            i++;
+        }
+        else
+        {
+            size_t start = i;
+            while (i < size && isWordChar(data[i]))
+                i++;
+            features.push_back(fingerprint64(std::string_view(data + start, i - start)));
+            text = fingerprint64(std::string_view(data + start, i - start), text);
+        }
+    }
+    if (textHash)
+        *textHash = text;
+    if (features.empty())
+        return 0;
+
+    std::sort(features.begin(), features.end());
+    int weights[64] = {};
+    for (size_t i = 0; i < features.size(); i++)
+    {
+        if (i > 0 && features[i] == features[i - 1])
+            continue;
+        for (int bit = 0; bit < 64; bit++)
+            weights[bit] += (features[i] >> bit) & 1 ? 1 : -1;
+    }
+    uint64_t simhash = 0;
+    for (int bit = 0; bit < 64; bit++)
+    {
+        if (weights[bit] > 0)
+            simhash |= uint64_t(1) << bit;
+    }
+    return simhash;
+}
+
+class TrapDetector
+{
+public:
+    explicit TrapDetector(TrapOptions options = TrapOptions()) : options(options) {}
+
+    // Decisions go to this file from now on
+    void openLog(const std::string &filename) { log.open(filename, std::ios::app); }
+
+    // Whether a discovered canonical URL may enter the frontier. isNew is true
+    // the first time the crawl sees this URL; only those count towards growth.
+    // Assets pass unless their pattern is quarantined. Every rule only ever
+    // tightens, so a URL turned down once is turned down every time it turns
+    // up again.
+    bool admit(std::string_view url, const UrlComponents &parts, bool isNew, bool asset = false)
+    {
+        std::string_view host = parts.host(url);
+        std::string_view path = parts.path(url);
+        uint64_t pattern = patternOf(host, path);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Pattern &state = patterns[pattern];
+        if (state.quarantined || (!directories.empty() && inQuarantinedDirectory(host, path)))
+            return drop(state);
+        if (asset)
+            return true;
+        // On every sighting, not just the first: the URL is known from then
+        // on, whether or not a value of it was dropped
+        if (parts.hasQuery() && !admitParameters(pattern, state, parts.query(url), url, isNew))
+            return drop(state);
+        if (!isNew)
+            return true;
+
+        if (countSegments(path) > options.maxPathSegments)
+            return loop(state, DEEP_PATH, url, host, path.substr(0, path.find('/', 1) + 1));
+        size_t repeat = repeatedSegments(path);
+        if (repeat != std::string_view::npos)
+            return loop(state, REPEATED_SEGMENTS, url, host, path.substr(0, repeat + 1));
+
+        Host &origin = hosts[fingerprint64(host)];
+        origin.newUrls++;
+        size_t allowance = suspect(state.nearDuplicates) ? options.suspectPatternUrls : options.maxPatternUrls;
+        if (origin.throttled)
+            allowance = std::min(allowance, options.throttledPatternUrls);
+        else if (suspect(origin.nearDuplicates) && origin.pages >= options.minHostPages &&
+                 origin.newUrls > options.maxHostGrowth * origin.pages)
+        {
+            origin.throttled = true;
+            record(HOST_GROWTH, url, std::to_string(origin.newUrls) + " new urls from " + std::to_string(origin.pages) +
+                                         " pages, patterns limited to " + std::to_string(options.throttledPatternUrls) +
+                                         " urls");
+            allowance = std::min(allowance, options.throttledPatternUrls);
+        }
+        if (++state.urls > allowance)
+            return quarantine(state, origin.throttled ? HOST_GROWTH : PATTERN_GROWTH, url);
+        return true;
+    }
+
+    // Records the content fingerprint of a fetched page
+    void observe(std::string_view url, const UrlComponents &parts, uint64_t simhash)
+    {
+        std::string_view host = parts.host(url);
+        uint64_t pattern = patternOf(host, parts.path(url));
+        std::lock_guard<std::mutex> lock(mutex);
+        Host &origin = hosts[fingerprint64(host)];
+        origin.pages++;
+        if (!simhash)
+            return;
+        Pattern &state = patterns[pattern];
+        size_t similar = 0;
+        for (uint64_t seen : state.recentPages)
+            similar += __builtin_popcountll(seen ^ simhash) <= options.maxSimhashDistance;
+        if (similar)
+        {
+            state.nearDuplicates++;
+            origin.nearDuplicates++;
+        }
+        if (similar >= options.maxDuplicatePages && !state.quarantined)
+        {
+            state.quarantined = true;
+            record(DUPLICATE_CONTENT, url, std::to_string(similar) + " recent pages of the pattern look the same");
+            return;
+        }
+        // A short ring of the latest pages is enough to spot a run
+        if (state.recentPages.size() < recentPageCount)
+            state.recentPages.push_back(simhash);
+        else
+            state.recentPages[state.nextPage++ % recentPageCount] = simhash;
+    }
+
+    void report(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!decisions && !dropped)
+            return;
+        out << "traps: " << decisions << " patterns quarantined or throttled, " << dropped << " urls dropped\n";
+    }
+
+private:
+    static constexpr size_t recentPageCount = 16;
+
+    struct Pattern
+    {
+        size_t urls = 0;
+        size_t dropped = 0;
+        // Fetched pages that looked like one of the recent ones
+        size_t nearDuplicates = 0;
+        bool quarantined = false;
+        std::vector<uint64_t> recentPages;
+        size_t nextPage = 0;
+    };
+
+    struct Host
+    {
+        size_t pages = 0;
+        size_t newUrls = 0;
+        size_t nearDuplicates = 0;
+        bool throttled = false;
+    };
+
+    // Values of one query parameter of one pattern. The first
+    // suspectParameterValues are remembered and always let through; past
+    // those, new URLs are only counted, and once the parameter explodes none
+    // of the unremembered values gets in any more.
+    struct Parameter
+    {
+        std::vector<uint64_t> values;
+        size_t beyond = 0;
+        bool exploded = false;
+    };
+
+    // Looping URLs seen below one directory
+    struct Directory
+    {
+        size_t loops = 0;
+        bool quarantined = false;
+    };
+
+    static uint64_t patternOf(std::string_view host, std::string_view path)
+    {
+        // Reused between calls; admit() runs on every discovered link
+        thread_local std::string key;
+        key.assign(host);
+        key += '/';
+        for (size_t i = 0; i < path.size(); i++)
+        {
+            if (path[i] >= '0' && path[i] <= '9')
+            {
+                while (i + 1 < path.size() && path[i + 1] >= '0' && path[i + 1] <= '9')
+                    i++;
+                key += '#';
+            }
+            else
+                key += path[i];
+        }
+        return fingerprint64(key);
+    }
+
+    static size_t countSegments(std::string_view path) { return std::count(path.begin(), path.end(), '/'); }
+
+    // /a/b/a/b/a/b: some run of 1 to 4 segments repeated back to back. Returns
+    // the offset in path where the run starts, or npos.
+    size_t repeatedSegments(std::string_view path) const
+    {
+        thread_local std::vector<std::string_view> segments;
+        segments.clear();
+        size_t start = 0;
+        while (start < path.size())
+        {
+            size_t slash = path.find('/', start + 1);
+            if (slash == std::string_view::npos)
+                slash = path.size();
+            segments.push_back(path.substr(start, slash - start));
+            start = slash;
+        }
+        size_t repeats = options.maxSequenceRepeats;
+        for (size_t length = 1; length <= 4; length++)
+        {
+            for (size_t i = 0; i + length * repeats <= segments.size(); i++)
+            {
+                size_t copies = 1;
+                while (copies < repeats && std::equal(segments.begin() + i, segments.begin() + i + length,
+                                                      segments.begin() + i + copies * length))
+                    copies++;
+                if (copies == repeats)
+                    return segments[i].data() - path.data();
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    // Whether some directory of path, "/a/" or "/a/b/" and so on, is quarantined
+    bool inQuarantinedDirectory(std::string_view host, std::string_view path) const
+    {
+        for (size_t slash = path.find('/', 1); slash != std::string_view::npos; slash = path.find('/', slash + 1))
+        {
+            auto directory = directories.find(patternOf(host, path.substr(0, slash + 1)));
+            if (directory != directories.end() && directory->second.quarantined)
+                return true;
+        }
+        return false;
+    }
+
+    // Quarantines the pattern of a looping URL, and the directory the loop
+    // hangs off once it has produced enough of them
+    bool loop(Pattern &state, trapreason reason, std::string_view url, std::string_view host,
+              std::string_view directory)
+    {
+        Directory &parent = directories[patternOf(host, directory)];
+        if (++parent.loops >= options.maxLoopUrls && !parent.quarantined)
+        {
+            parent.quarantined = true;
+            record(reason, url,
+                   "directory " + std::string(directory) + " quarantined after " + std::to_string(parent.loops) +
+                       " looping urls");
+            state.quarantined = true;
+            return drop(state);
+        }
+        return quarantine(state, reason, url);
+    }
+
+    bool suspect(size_t nearDuplicates) const { return nearDuplicates >= options.suspectPages; }
+
+    bool admitParameters(uint64_t pattern, const Pattern &owner, std::string_view query, std::string_view url,
+                         bool isNew)
+    {
+        size_t start = 0;
+        while (start <= query.size())
+        {
+            size_t amp = query.find('&', start);
+            if (amp == std::string_view::npos)
+                amp = query.size();
+            std::string_view param = query.substr(start, amp - start);
+            start = amp + 1;
+            size_t equals = param.find('=');
+            if (equals == std::string_view::npos)
+                continue;
+            Parameter &state = parameters[pattern ^ fingerprint64(param.substr(0, equals))];
+            uint64_t value = fingerprint64(param.substr(equals + 1));
+            if (std::find(state.values.begin(), state.values.end(), value) != state.values.end())
+                continue;
+            if (state.values.size() < options.suspectParameterValues)
+            {
+                state.values.push_back(value);
+                continue;
+            }
+            if (!state.exploded)
+            {
+                size_t limit = suspect(owner.nearDuplicates) ? 0 : options.maxParameterValues - state.values.size();
+                if (state.beyond + isNew <= limit)
+                {
+                    state.beyond += isNew;
+                    continue;
+                }
+                state.exploded = true;
+                record(PARAMETER_VALUES, url,
+                       "parameter " + std::string(param.substr(0, equals)) + " took more than " +
+                           std::to_string(state.values.size() + state.beyond) + " values" +
+                           (suspect(owner.nearDuplicates) ? " on a pattern whose pages repeat" : "") +
+                           "; new values dropped");
+            }
+            return false;
+        }
+        return true;
+    }
+
+    bool quarantine(Pattern &state, trapreason reason, std::string_view url)
+    {
+        state.quarantined = true;
+        record(reason, url, "pattern quarantined after " + std::to_string(state.urls) + " urls");
+        return drop(state);
+    }
+
+    bool drop(Pattern &state)
+    {
+        state.dropped++;
+        dropped++;
+        return false;
+    }
+
+    void record(trapreason reason, std::string_view url, const std::string &detail)
+    {
+        static const char *const reasons[] = {"repeated-segments", "deep-path",   "pattern-growth",
+                                              "parameter-values",  "host-growth", "duplicate-content"};
+        decisions++;
+        if (log.is_open())
+        {
+            log << reasons[reason] << " " << url << " " << detail << "\n";
+            log.flush();
+        }
+    }
+
+    TrapOptions options;
+    std::mutex mutex;
+    std::ofstream log;
+    std::unordered_map<uint64_t, Pattern> patterns;
+    std::unordered_map<uint64_t, Host> hosts;
+    std::unordered_map<uint64_t, Parameter> parameters;
+    std::unordered_map<uint64_t, Directory> directories;
+    size_t decisions = 0;
+    size_t dropped = 0;
+};
@@ -0,0 +1,234 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "resolve.h"
+
+// Byte offsets of the components of an absolute hierarchical URL
+// ("scheme://authority/path?query#fragment"), filled in by parseUrl() in one
+// pass so later stages can slice the URL instead of searching it again.
+// Absent components are empty ranges: no port means portEnd == hostEnd, no
+// query means queryStart == fragmentStart, no fragment means fragmentStart ==
+// size.
+struct UrlComponents
+{
+    uint32_t schemeEnd;     // the ':' after the scheme
+    uint32_t hostStart;     // after "//" and any "userinfo@"
+    uint32_t hostEnd;       // the ':' before the port, or pathStart
+    uint32_t pathStart;     // end of the authority
+    uint32_t queryStart;    // the '?', or fragmentStart
+    uint32_t fragmentStart; // the '#', or size
+    uint32_t size;
+
+    std::string_view scheme(std::string_view url) const { return url.substr(0, schemeEnd); }
+    // "user:password@" including the '@', usually empty
+    std::string_view userinfo(std::string_view url) const { return url.substr(schemeEnd + 3, hostStart - schemeEnd - 3); }
+    std::string_view host(std::string_view url) const { return url.substr(hostStart, hostEnd - hostStart); }
+    std::string_view port(std::string_view url) const
+    {
+        return hostEnd == pathStart ? std::string_view() : url.substr(hostEnd + 1, pathStart - hostEnd - 1);
+    }
+    std::string_view path(std::string_view url) const { return url.substr(pathStart, queryStart - pathStart); }
+    bool hasQuery() const { return queryStart != fragmentStart; }
+    std::string_view query(std::string_view url) const
+    {
+        return hasQuery() ? url.substr(queryStart + 1, fragmentStart - queryStart - 1) : std::string_view();
+    }
+    bool hasFragment() const { return fragmentStart != size; }
+    std::string_view fragment(std::string_view url) const
+    {
+        return hasFragment() ? url.substr(fragmentStart + 1) : std::string_view();
+    }
+};
+
+// What each scan stops at. The authority scan stops at every delimiter it has
+// to interpret and at bytes that may not appear in a host; the path scan only
+// at '?', '#' and control bytes; the fragment scan only at control bytes.
+// Spaces and non-ASCII bytes are legal in the path, query and fragment since
+// the canonicalizer escapes them.
+enum urlscan
+{
+    AUTHORITY_SCAN = 1,
+    PATH_SCAN = 2,
+    FRAGMENT_SCAN = 4
+};
+
+constexpr std::array<uint8_t, 256> buildUrlStopTable()
+{
+    std::array<uint8_t, 256> table = {};
+    for (int c = 0; c < 0x20; c++)
+        table[c] = AUTHORITY_SCAN | PATH_SCAN | FRAGMENT_SCAN;
+    table[0x7f] = AUTHORITY_SCAN | PATH_SCAN | FRAGMENT_SCAN;
+    for (char c : {' ', '/', '?', '#', '@', ':', '[', ']'})
+        table[static_cast<unsigned char>(c)] |= AUTHORITY_SCAN;
+    table['?'] |= PATH_SCAN;
+    table['#'] |= PATH_SCAN;
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> urlStopTable = buildUrlStopTable();
+
+// Position of the next byte the given scan stops at, or size. Bytes that do
+// not matter are skipped 16 at a time.
+template <urlscan scan>
+inline size_t nextUrlStop(const char *data, size_t size, size_t pos)
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i controlEnd = _mm_set1_epi8(scan == AUTHORITY_SCAN ? 0x21 : 0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    while (pos + 16 <= size)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        // Signed compare: bytes from 0x80 up are negative and never stop a scan
+        __m128i hits = _mm_or_si128(_mm_andnot_si128(_mm_cmplt_epi8(block, zero), _mm_cmplt_epi8(block, controlEnd)),
+                                    _mm_cmpeq_epi8(block, del));
+        if (scan != FRAGMENT_SCAN)
+            hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('?')),
+                                                   _mm_cmpeq_epi8(block, _mm_set1_epi8('#'))));
+        if (scan == AUTHORITY_SCAN)
+        {
+            hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('/')),
+                                                   _mm_cmpeq_epi8(block, _mm_set1_epi8('@'))));
+            hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(':')),
+                                                   _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('[')),
+                                                                _mm_cmpeq_epi8(block, _mm_set1_epi8(']')))));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+    for (; pos < size; pos++)
+    {
+        if (urlStopTable[static_cast<unsigned char>(data[pos])] & scan)
+            return pos;
+    }
+    return size;
+}
+
+// Characters WHATWG forbids in a host besides those the authority scan
+// already stops at
+inline bool isForbiddenHostChar(char c)
+{
+    return c == '<' || c == '>' || c == '^' || c == '|' || c == '\\' || c == '"';
+}
+
+// Splits an absolute URL with an authority into its components. Returns false
+// for anything malformed: no scheme, no "//", an empty host, a bad port, an
+// unclosed IPv6 literal or control bytes anywhere.
+inline bool parseUrl(std::string_view url, UrlComponents &parts)
+{
+    const char *data = url.data();
+    size_t size = url.size();
+    if (size >= UINT32_MAX)
+        return false;
+
+    size_t pos = 0;
+    while (pos < size && isSchemeChar(data[pos], pos == 0))
+        pos++;
+    if (pos == 0 || size - pos < 3 || data[pos] != ':' || data[pos + 1] != '/' || data[pos + 2] != '/')
+        return false;
+    parts.schemeEnd = pos;
+    pos += 3;
+
+    size_t hostStart = pos;
+    size_t portColon = 0;
+    bool bracket = false, closed = false;
+    for (;; pos++)
+    {
+        pos = nextUrlStop<AUTHORITY_SCAN>(data, size, pos);
+        if (pos == size)
+            break;
+        char c = data[pos];
+        if (c == '/' || c == '?' || c == '#')
+            break;
+        if (c == '@')
+        {
+            // Whatever came before was userinfo
+            hostStart = pos + 1;
+            portColon = 0;
+            bracket = closed = false;
+        }
+        else if (c == '[' && pos == hostStart && !bracket)
+            bracket = true;
+        else if (c == ']' && bracket && !closed)
+            closed = true;
+        else if (c == ':')
+        {
+            if (!bracket || closed)
+                portColon = pos;
+        }
+        else
+            return false;
+    }
+    if (bracket && !closed)
+        return false;
+    size_t hostEnd = portColon ? portColon : pos;
+    if (hostEnd == hostStart)
+        return false;
+    if (!bracket)
+    {
+        for (size_t i = hostStart; i < hostEnd; i++)
+        {
+            if (isForbiddenHostChar(data[i]))
+                return false;
+        }
+    }
+    if (portColon)
+    {
+        uint32_t port = 0;
+        for (size_t i = portColon + 1; i < pos; i++)
+        {
+            if (data[i] < '0' || data[i] > '9')
+                return false;
+            port = port * 10 + (data[i] - '0');
+            if (port > 65535)
+                return false;
+        }
+    }
+    parts.hostStart = hostStart;
+    parts.hostEnd = hostEnd;
+    parts.pathStart = pos;
+
+    size_t queryStart = size;
+    for (;; pos++)
+    {
+        pos = nextUrlStop<PATH_SCAN>(data, size, pos);
+        if (pos == size || data[pos] == '#')
+            break;
+        if (data[pos] != '?')
+            return false;
+        // Later '?' belong to the query
+        if (queryStart == size)
+            queryStart = pos;
+    }
+    parts.fragmentStart = pos;
+    parts.queryStart = queryStart == size ? pos : queryStart;
+    if (pos < size && nextUrlStop<FRAGMENT_SCAN>(data, size, pos + 1) != size)
+        return false;
+    parts.size = size;
+    return true;
+}
+
+// Only http and https links are worth a request; mailto:, javascript:, tel:,
+// data: and the rest are dropped at extraction
+inline bool isCrawlableScheme(std::string_view scheme)
+{
+    auto is = [&](std::string_view name)
+    {
+        if (scheme.size() != name.size())
+            return false;
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            if ((scheme[i] | 0x20) != name[i])
+                return false;
+        }
+        return true;
+    };
+    return is("http") || is("https");
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "fingerprint.h"
+#include "fingerprint_set.h"
+
+// Dense identifier of an interned URL
+using UrlId = uint32_t;
+
+constexpr UrlId invalidUrlId = UINT32_MAX;
+
+// Crawler-wide URL interning table. Every distinct URL is stored once in an
+// append-only arena and gets a dense 32-bit ID; the frontier, the visited
+// state and the storage index pass IDs around instead of strings.
+//
+// The index from URL to ID is a Swiss-table (see fingerprint_set.h) whose
+// groups each fill one cache line: the control bytes of 12 slots and their
+// IDs. A lookup reads one line per group probed, and follows only IDs whose
+// tag matches to the entries, the exact backing store the URL is checked
+// against.
+//
+// intern() takes a lock. get() does not: entries and bytes never move, so an
+// ID handed to another thread through any synchronised channel can be read
+// back freely.
+class UrlTable
+{
+public:
+    UrlTable() : index(initialGroups), chunks(maxChunks) {}
+
+    UrlTable(const UrlTable &) = delete;
+    UrlTable &operator=(const UrlTable &) = delete;
+
+    // Returns the ID of url and whether this call added it
+    std::pair<UrlId, bool> intern(std::string_view url)
+    {
+        uint32_t hash = hashOf(url);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        uint8_t tag = tagOf(hash);
+        size_t group = hash & groupMask;
+        for (size_t step = 1;; step++)
+        {
+            const IndexGroup &slots = index[group];
+            for (uint32_t hits = matchTag(slots.control, tag) & slotMask; hits; hits &= hits - 1)
+            {
+                UrlId id = slots.ids[__builtin_ctz(hits)];
+                const Entry &entry = at(id);
+                if (entry.hash == hash && std::string_view(entry.data, entry.size) == url)
+                    return {id, false};
+            }
+            if (matchEmpty(slots.control) & slotMask)
+                break;
+            group = (group + step) & groupMask;
+        }
+
+        UrlId id = static_cast<UrlId>(count.load(std::memory_order_relaxed));
+        if (id == invalidUrlId)
+            return {invalidUrlId, false};
+        if (!chunks[id >> chunkBits])
+            chunks[id >> chunkBits].reset(new Entry[chunkSize]);
+        at(id) = {store(url), static_cast<uint32_t>(url.size()), hash};
+        count.store(id + 1, std::memory_order_release);
+
+        // Keep the index at most 7/8 full
+        if (size_t(id + 1) * 8 > index.size() * groupSlots * 7)
+            grow();
+        else
+            insertSlot(id, hash);
+        return {id, true};
+    }
+
+    // NUL terminated view of an interned URL
+    std::string_view get(UrlId id) const
+    {
+        const Entry &entry = chunks[id >> chunkBits][id & (chunkSize - 1)];
+        return std::string_view(entry.data, entry.size);
+    }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+    // Bytes held by the arena, the entries and the hash index
+    size_t memoryBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        return arenaBytes + chunkCount * chunkSize * sizeof(Entry) + index.size() * sizeof(IndexGroup) +
+               chunks.size() * sizeof(chunks[0]);
+    }
+
+private:
+    static constexpr size_t groupSlots = 12;
+    static constexpr uint32_t slotMask = (uint32_t(1) << groupSlots) - 1;
+
+    // The last 4 control bytes are padding, masked off every match
+    struct alignas(64) IndexGroup
+    {
+        uint8_t control[groupWidth];
+        UrlId ids[groupSlots];
+
+        IndexGroup() { memset(control, emptyControl, sizeof(control)); }
+    };
+
+    struct Entry
+    {
+        const char *data;
+        uint32_t size;
+        uint32_t hash;
+    };
+
+    static constexpr size_t chunkBits = 16;
+    static constexpr size_t chunkSize = size_t(1) << chunkBits;
+    static constexpr size_t maxChunks = (size_t(1) << 32) / chunkSize;
+    static constexpr size_t initialGroups = 64;
+    static constexpr size_t blockSize = 1 << 20;
+
+    static uint32_t hashOf(std::string_view url)
+    {
+        uint64_t hash = fingerprint64(url);
+        return static_cast<uint32_t>(hash ^ (hash >> 32));
+    }
+
+    // The low bits of the hash pick the group, the top 7 are the tag
+    static uint8_t tagOf(uint32_t hash) { return hash >> 25; }
+
+    Entry &at(UrlId id) { return chunks[id >> chunkBits][id & (chunkSize - 1)]; }
+
+    const char *store(std::string_view url)
+    {
+        char *out;
+        if (url.size() + 1 > blockSize)
+        {
+            // Oversized URLs get a block of their own
+            large.emplace_back(new char[url.size() + 1]);
+            arenaBytes += url.size() + 1;
+            out = large.back().get();
+        }
+        else
+        {
+            if (blocks.empty() || url.size() + 1 > blockSize - blockUsed)
+            {
+                blocks.emplace_back(new char[blockSize]);
+                arenaBytes += blockSize;
+                blockUsed = 0;
+            }
+            out = blocks.back().get() + blockUsed;
+            blockUsed += url.size() + 1;
+        }
+        memcpy(out, url.data(), url.size());
+        out[url.size()] = '\0';
+        return out;
+    }
+
+    void insertSlot(UrlId id, uint32_t hash)
+    {
+        size_t group = hash & groupMask;
+        for (size_t step = 1;; step++)
+        {
+            IndexGroup &slots = index[group];
+            uint32_t empty = matchEmpty(slots.control) & slotMask;
+            if (empty)
+            {
+                size_t slot = __builtin_ctz(empty);
+                slots.control[slot] = tagOf(hash);
+                slots.ids[slot] = id;
+                return;
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    void grow()
+    {
+        size_t groups = index.size() * 2;
+        index.assign(groups, IndexGroup());
+        groupMask = groups - 1;
+        size_t total = count.load(std::memory_order_relaxed);
+        for (UrlId id = 0; id < total; id++)
+            insertSlot(id, at(id).hash);
+    }
+
+    std::mutex mutex;
+    std::vector<IndexGroup> index;
+    size_t groupMask = initialGroups - 1;
+    std::vector<std::unique_ptr<Entry[]>> chunks;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> large;
+    size_t blockUsed = 0;
+    size_t arenaBytes = 0;
+    std::atomic<size_t> count{0};
+};
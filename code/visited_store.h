@@ -0,0 +1,477 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fingerprint_set.h"
+
+// Set of URL fingerprints that outgrows memory, in two tiers:
+//
+//   - a blocked Bloom filter in RAM, one cache line per key, answers
+//     "definitely new" for most new URLs without looking any further;
+//   - the exact set: recent fingerprints in an in-memory FingerprintSet, the
+//     rest in sorted run files on disk. Each run has a sparse index in RAM,
+//     the first fingerprint of every 4 KiB block, so confirming a key costs
+//     one block read per run. Runs are merged once there are too many.
+//
+// Keys are checked a batch at a time. Only those the filter cannot rule out
+// and the recent set does not hold go to disk, sorted, so keys that fall in
+// the same block share one read.
+struct VisitedOptions
+{
+    // Keys the Bloom filter is sized for at first; it doubles when outgrown
+    size_t expectedKeys = size_t(1) << 20;
+    size_t bloomBitsPerKey = 10;
+    // Recent fingerprints kept in memory before they are written out as a run
+    size_t memtableKeys = size_t(1) << 22;
+    size_t maxRuns = 8;
+};
+
+class VisitedStore
+{
+public:
+    explicit VisitedStore(std::string folder, VisitedOptions options = VisitedOptions())
+        : folder(std::move(folder)), options(options)
+    {
+        std::error_code error;
+        std::filesystem::remove_all(this->folder, error);
+        std::filesystem::create_directories(this->folder, error);
+        bloomCapacity = options.expectedKeys;
+        bloom.assign(bloomBlocks(bloomCapacity), BloomBlock());
+        flushAt = options.memtableKeys;
+    }
+
+    ~VisitedStore()
+    {
+        for (auto &run : runs)
+            close(run.fd);
+        std::error_code error;
+        std::filesystem::remove_all(folder, error);
+    }
+
+    VisitedStore(const VisitedStore &) = delete;
+    VisitedStore &operator=(const VisitedStore &) = delete;
+
+    // Adds every fingerprint of batch. isNew[i] is set when batch[i] had not
+    // been seen before, earlier in the batch included.
+    void insert(const std::vector<uint64_t> &batch, std::vector<bool> &isNew)
+    {
+        isNew.assign(batch.size(), false);
+        std::unique_lock<std::mutex> lock(mutex);
+        checks += batch.size();
+
+        // Reused between batches: indexes of keys the memory tiers could not
+        // settle
+        thread_local std::vector<size_t> uncertain;
+        uncertain.clear();
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            uint64_t key = batch[i];
+            if (!bloomAdd(bloom, key))
+            {
+                isNew[i] = true;
+                addKey(key);
+            }
+            else if (!memtable.contains(key))
+            {
+                if (runs.empty())
+                {
+                    // Nothing on disk: the filter was simply wrong
+                    falsePositives++;
+                    isNew[i] = true;
+                    addKey(key);
+                }
+                else
+                    uncertain.push_back(i);
+            }
+        }
+
+        if (!uncertain.empty())
+        {
+            std::sort(uncertain.begin(), uncertain.end(), [&](size_t a, size_t b) { return batch[a] < batch[b]; });
+            diskChecks += uncertain.size();
+            // One run at a time, so neighbouring keys share its block reads
+            thread_local std::vector<bool> found;
+            found.assign(uncertain.size(), false);
+            for (auto &run : runs)
+            {
+                for (size_t j = 0; j < uncertain.size(); j++)
+                {
+                    if (!found[j])
+                        found[j] = runContains(run, batch[uncertain[j]]);
+                }
+            }
+            for (size_t j = 0; j < uncertain.size(); j++)
+            {
+                // A key twice in the batch is only new the first time
+                if (!found[j] && !memtable.contains(batch[uncertain[j]]))
+                {
+                    falsePositives++;
+                    isNew[uncertain[j]] = true;
+                    addKey(batch[uncertain[j]]);
+                }
+            }
+        }
+
+        if (memtable.size() >= flushAt)
+            flush();
+        if (keys > bloomCapacity && !growing)
+            growBloom(lock);
+    }
+
+    // Bytes of RAM: filter, recent set and sparse indexes
+    size_t memoryBytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = bloom.size() * sizeof(BloomBlock) + memtable.memoryBytes();
+        for (const auto &run : runs)
+            bytes += run.firstKeys.size() * sizeof(uint64_t);
+        return bytes;
+    }
+
+    void report(std::ostream &out, double seconds) const
+    {
+        size_t memory = memoryBytes();
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t onDisk = 0;
+        for (const auto &run : runs)
+            onDisk += run.keys;
+        out << "visited: " << keys << " urls, " << memory / 1024 << " KiB in memory, " << runs.size() << " runs with "
+            << onDisk << " on disk; " << checks << " checks, " << diskChecks << " went to disk";
+        // Every new key was first put to the filter
+        if (keys)
+            out << ", filter false positives " << 100.0 * falsePositives / keys << "%";
+        out << ", " << blockReads << " block reads";
+        if (seconds > 0)
+            out << " (" << static_cast<size_t>(blockReads / seconds) << " IOPS)";
+        out << "\n";
+    }
+
+private:
+    static constexpr size_t blockKeys = 4096 / sizeof(uint64_t);
+
+    // One cache line of the filter; a key sets 8 of its 512 bits
+    struct alignas(64) BloomBlock
+    {
+        uint64_t words[8];
+    };
+
+    struct Run
+    {
+        std::string filename;
+        int fd;
+        size_t keys;
+        // First fingerprint of every block
+        std::vector<uint64_t> firstKeys;
+    };
+
+    size_t bloomBlocks(size_t capacity) const { return std::max<size_t>(1, capacity * options.bloomBitsPerKey / 512); }
+
+    // Sets the bits of key in filter; returns whether they were all set already
+    static bool bloomAdd(std::vector<BloomBlock> &filter, uint64_t key)
+    {
+        // The top bits of the key pick the block; the bits inside it come from
+        // a remix, so they do not depend on the block
+        BloomBlock &block = filter[static_cast<uint64_t>((static_cast<unsigned __int128>(key) * filter.size()) >> 64)];
+        uint64_t mixed = key * 0x9e3779b97f4a7c15ull;
+        uint32_t h1 = static_cast<uint32_t>(mixed), h2 = static_cast<uint32_t>(mixed >> 32) | 1;
+        bool present = true;
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            uint32_t bit = (h1 + i * h2) & 511;
+            uint64_t mask = uint64_t(1) << (bit & 63);
+            present &= (block.words[bit >> 6] & mask) != 0;
+            block.words[bit >> 6] |= mask;
+        }
+        return present;
+    }
+
+    void addKey(uint64_t key)
+    {
+        memtable.insert(key);
+        keys++;
+        if (growing)
+            grownKeys.push_back(key);
+    }
+
+    // Rebuilds the filter at twice the size from both exact tiers. Reading the
+    // runs takes a while, so it happens with the lock released: lookups go on
+    // against the old filter, the keys they add meanwhile are logged and put
+    // to the new one before it is swapped in. The runs are read through
+    // duplicated descriptors, since a merge may close and delete them.
+    void growBloom(std::unique_lock<std::mutex> &lock)
+    {
+        growing = true;
+        size_t capacity = bloomCapacity * 2;
+        std::vector<uint64_t> recent;
+        recent.reserve(memtable.size());
+        memtable.forEach([&](uint64_t key) { recent.push_back(key); });
+        std::vector<Run> snapshot;
+        for (const auto &run : runs)
+            snapshot.push_back({run.filename, dup(run.fd), run.keys, {}});
+        lock.unlock();
+
+        std::vector<BloomBlock> filter(bloomBlocks(capacity));
+        for (uint64_t key : recent)
+            bloomAdd(filter, key);
+        for (const auto &run : snapshot)
+        {
+            if (run.fd >= 0)
+            {
+                RunReader reader(run);
+                uint64_t key;
+                while (reader.next(key))
+                    bloomAdd(filter, key);
+                close(run.fd);
+            }
+            else
+                std::cerr << "Could not reopen visited run " << run.filename << "\n";
+        }
+
+        lock.lock();
+        for (uint64_t key : grownKeys)
+            bloomAdd(filter, key);
+        grownKeys.clear();
+        grownKeys.shrink_to_fit();
+        bloom.swap(filter);
+        bloomCapacity = capacity;
+        growing = false;
+    }
+
+    bool runContains(Run &run, uint64_t key)
+    {
+        auto after = std::upper_bound(run.firstKeys.begin(), run.firstKeys.end(), key);
+        if (after == run.firstKeys.begin())
+            return false;
+        size_t block = after - run.firstKeys.begin() - 1;
+        if (&run != cachedRun || block != cachedBlock)
+        {
+            size_t count = std::min(blockKeys, run.keys - block * blockKeys);
+            ssize_t bytes = pread(run.fd, blockBuffer, count * sizeof(uint64_t), block * blockKeys * sizeof(uint64_t));
+            blockReads++;
+            if (bytes != static_cast<ssize_t>(count * sizeof(uint64_t)))
+            {
+                std::cerr << "Could not read visited run " << run.filename << "\n";
+                cachedRun = nullptr;
+                return false;
+            }
+            cachedRun = &run;
+            cachedBlock = block;
+            cachedCount = count;
+        }
+        return std::binary_search(blockBuffer, blockBuffer + cachedCount, key);
+    }
+
+    // Sequential reader over a run, for merges and filter rebuilds
+    struct RunReader
+    {
+        explicit RunReader(const Run &run) : run(run), buffer(new uint64_t[bufferKeys]) {}
+
+        bool next(uint64_t &key)
+        {
+            if (position == filled)
+            {
+                size_t count = std::min(bufferKeys, run.keys - offset);
+                if (count == 0)
+                    return false;
+                if (pread(run.fd, buffer.get(), count * sizeof(uint64_t), offset * sizeof(uint64_t)) !=
+                    static_cast<ssize_t>(count * sizeof(uint64_t)))
+                {
+                    std::cerr << "Could not read visited run " << run.filename << "\n";
+                    return false;
+                }
+                offset += count;
+                filled = count;
+                position = 0;
+            }
+            key = buffer[position++];
+            return true;
+        }
+
+        static constexpr size_t bufferKeys = size_t(1) << 17;
+        const Run &run;
+        std::unique_ptr<uint64_t[]> buffer;
+        size_t offset = 0, position = 0, filled = 0;
+    };
+
+    // Appends sorted keys to a new run file. Failures are left to the caller
+    // to report.
+    struct RunWriter
+    {
+        RunWriter(std::string filename) : filename(std::move(filename))
+        {
+            fd = open(this->filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                error = errno;
+        }
+
+        void add(uint64_t key)
+        {
+            if (keys % blockKeys == 0)
+                firstKeys.push_back(key);
+            buffer.push_back(key);
+            keys++;
+            if (buffer.size() == bufferKeys)
+                drain();
+        }
+
+        bool drain()
+        {
+            const char *bytes = reinterpret_cast<const char *>(buffer.data());
+            size_t remaining = buffer.size() * sizeof(uint64_t);
+            while (fd >= 0 && remaining > 0)
+            {
+                ssize_t written = write(fd, bytes, remaining);
+                if (written <= 0)
+                {
+                    error = written < 0 ? errno : ENOSPC;
+                    failed = true;
+                    break;
+                }
+                bytes += written;
+                remaining -= written;
+            }
+            buffer.clear();
+            return fd >= 0 && !failed;
+        }
+
+        // Closes and deletes what was written
+        void discard()
+        {
+            if (fd >= 0)
+                close(fd);
+            unlink(filename.c_str());
+        }
+
+        static constexpr size_t bufferKeys = size_t(1) << 17;
+        std::string filename;
+        int fd;
+        size_t keys = 0;
+        bool failed = false;
+        int error = 0;
+        std::vector<uint64_t> firstKeys;
+        std::vector<uint64_t> buffer;
+    };
+
+    // Writes the recent set out as the newest run, merging all runs into one
+    // once there are too many. If the run cannot be written the keys stay in
+    // memory, and the next attempt waits for a quarter of memtableKeys more of
+    // them, then half, and so on: sorting millions of keys again on every
+    // batch would stall every lookup while the disk stays full.
+    void flush()
+    {
+        std::vector<uint64_t> sorted;
+        sorted.reserve(memtable.size());
+        memtable.forEach([&](uint64_t key) { sorted.push_back(key); });
+        std::sort(sorted.begin(), sorted.end());
+
+        RunWriter writer(folder + "/run-" + std::to_string(created++));
+        for (uint64_t key : sorted)
+            writer.add(key);
+        if (!writer.drain())
+        {
+            writer.discard();
+            flushFailures++;
+            retryStep = retryStep ? std::min(retryStep * 2, options.memtableKeys) : std::max<size_t>(options.memtableKeys / 4, 1);
+            flushAt = memtable.size() + retryStep;
+            if (flushFailures == 1)
+                std::cerr << "Could not write visited run " << writer.filename << ": " << strerror(writer.error)
+                          << "; keeping the keys in memory and retrying after " << retryStep << " more\n";
+            return;
+        }
+        if (flushFailures)
+            std::cerr << "Visited run " << writer.filename << " written after " << flushFailures << " failed attempts\n";
+        flushFailures = 0;
+        retryStep = 0;
+        flushAt = options.memtableKeys;
+        memtable.clear();
+        runs.push_back({writer.filename, writer.fd, writer.keys, std::move(writer.firstKeys)});
+        cachedRun = nullptr;
+        if (runs.size() > options.maxRuns)
+            merge();
+    }
+
+    // k-way merge of every run into one; runs never share keys
+    void merge()
+    {
+        RunWriter writer(folder + "/run-" + std::to_string(created++));
+        std::vector<std::unique_ptr<RunReader>> readers;
+        std::vector<std::pair<uint64_t, size_t>> heads;
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            readers.emplace_back(new RunReader(runs[i]));
+            uint64_t key;
+            if (readers[i]->next(key))
+                heads.push_back({key, i});
+        }
+        auto greater = [](const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b)
+        { return a.first > b.first; };
+        std::make_heap(heads.begin(), heads.end(), greater);
+        while (!heads.empty())
+        {
+            std::pop_heap(heads.begin(), heads.end(), greater);
+            auto [key, source] = heads.back();
+            heads.pop_back();
+            writer.add(key);
+            if (readers[source]->next(key))
+            {
+                heads.push_back({key, source});
+                std::push_heap(heads.begin(), heads.end(), greater);
+            }
+        }
+        readers.clear();
+        if (!writer.drain())
+        {
+            // The runs stay as they are; the next flush tries again
+            std::cerr << "Could not merge visited runs into " << writer.filename << ": " << strerror(writer.error) << "\n";
+            writer.discard();
+            return;
+        }
+        for (auto &run : runs)
+        {
+            close(run.fd);
+            unlink(run.filename.c_str());
+        }
+        runs.clear();
+        runs.push_back({writer.filename, writer.fd, writer.keys, std::move(writer.firstKeys)});
+        cachedRun = nullptr;
+    }
+
+    std::string folder;
+    VisitedOptions options;
+    mutable std::mutex mutex;
+
+    std::vector<BloomBlock> bloom;
+    size_t bloomCapacity = 0;
+    // While growBloom() rebuilds the filter, the keys added in the meantime
+    bool growing = false;
+    std::vector<uint64_t> grownKeys;
+    FingerprintSet memtable;
+    // Memtable size that triggers the next flush, and how far it was moved
+    // out after the last failed one
+    size_t flushAt = 0;
+    size_t retryStep = 0;
+    size_t flushFailures = 0;
+    std::vector<Run> runs;
+    size_t created = 0;
+
+    // The last block read, which the next key of a sorted batch often needs
+    const Run *cachedRun = nullptr;
+    size_t cachedBlock = 0;
+    size_t cachedCount = 0;
+    uint64_t blockBuffer[blockKeys];
+
+    size_t keys = 0;
+    size_t checks = 0;
+    size_t diskChecks = 0;
+    size_t falsePositives = 0;
+    size_t blockReads = 0;
+};
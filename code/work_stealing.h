@@ -0,0 +1,320 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Chase-Lev work-stealing deque (Chase and Lev, "Dynamic Circular
+// Work-Stealing Deque", with the C11 orderings of Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models").
+//
+// The owner thread pushes and pops at the bottom, last in first out, with no
+// atomic read-modify-write unless it is down to the last item; any other
+// thread steals the oldest item from the top with one compare-and-swap. The
+// array doubles when full; the owner keeps the old ones until the deque goes,
+// since a thief may still be reading them.
+template <typename T>
+class WorkDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "items are copied through atomics");
+
+public:
+    explicit WorkDeque(size_t capacity = 256)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        arrays.emplace_back(new Array(size));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkDeque(const WorkDeque &) = delete;
+    WorkDeque &operator=(const WorkDeque &) = delete;
+
+    // Owner only
+    void push(T item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array *a = array.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(a->mask))
+            a = grow(a, t, b);
+        a->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only: takes the newest item. Returns false when empty.
+    bool pop(T &item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        T taken = a->get(b);
+        if (t == b)
+        {
+            // The last item: race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won)
+                return false;
+        }
+        item = taken;
+        return true;
+    }
+
+    // Any thread: takes the oldest item. Returns false when empty or when
+    // another thread got there first.
+    bool steal(T &item)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        Array *a = array.load(std::memory_order_acquire);
+        T taken = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        item = taken;
+        return true;
+    }
+
+    // A snapshot that may be stale
+    bool empty() const
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        return b <= t;
+    }
+
+private:
+    struct Array
+    {
+        explicit Array(size_t size) : mask(size - 1), slots(new std::atomic<T>[size]) {}
+
+        T get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, T item) { slots[index & mask].store(item, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+    };
+
+    Array *grow(Array *old, int64_t t, int64_t b)
+    {
+        arrays.emplace_back(new Array((old->mask + 1) * 2));
+        Array *a = arrays.back().get();
+        for (int64_t i = t; i < b; i++)
+            a->put(i, old->get(i));
+        array.store(a, std::memory_order_release);
+        return a;
+    }
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Array *> array;
+    // Every array this deque has had, the current one last
+    std::vector<std::unique_ptr<Array>> arrays;
+};
+
+// Fixed set of worker threads, each with a WorkDeque of tasks, plus one
+// injection queue for tasks submitted from other threads.
+//
+// A task spawn()ed by a running task goes onto its own worker's deque and is
+// usually run next by that worker, while the data it shares with its parent is
+// still in cache. A worker with nothing of its own takes from the injection
+// queue, oldest first, and failing that steals the oldest task of another
+// worker, which tends to be the largest piece of work left there. Workers
+// with nothing to do sleep until a task turns up.
+//
+// submit() blocks while injectLimit submitted tasks are waiting, which is what
+// slows submitters down when the workers fall behind.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    WorkStealingPool(int workers, size_t injectLimit) : injectLimit(std::max<size_t>(injectLimit, 1))
+    {
+        for (int i = 0; i < std::max(workers, 1); i++)
+            deques.emplace_back(new WorkDeque<Task *>());
+        for (size_t i = 0; i < deques.size(); i++)
+            threads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+
+    ~WorkStealingPool() { close(); }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Queues task from outside the pool
+    void submit(Task task)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (injected.size() >= injectLimit)
+            {
+                auto start = std::chrono::steady_clock::now();
+                notFull.wait(lock, [this] { return injected.size() < injectLimit; });
+                blockedNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+            injected.push_back(new Task(std::move(task)));
+            maxInjected = std::max(maxInjected.load(std::memory_order_relaxed), injected.size());
+            queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        wake();
+    }
+
+    // Queues task on the calling worker's own deque; from outside the pool it
+    // is submitted instead
+    void spawn(Task task)
+    {
+        if (current.pool != this)
+        {
+            submit(std::move(task));
+            return;
+        }
+        // Counted before a thief can take it, so the count never goes below zero
+        queued.fetch_add(1, std::memory_order_relaxed);
+        spawned.fetch_add(1, std::memory_order_relaxed);
+        deques[current.index]->push(new Task(std::move(task)));
+        wake();
+    }
+
+    // Runs everything still queued, then stops the workers
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closing)
+                return;
+            closing = true;
+        }
+        idle.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    int workers() const { return static_cast<int>(deques.size()); }
+
+    // Submitted tasks waiting for a worker
+    size_t waiting()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return injected.size();
+    }
+
+    const size_t injectLimit;
+    std::atomic<size_t> maxInjected{0};
+    std::atomic<uint64_t> spawned{0};
+    std::atomic<uint64_t> stolen{0};
+    // Total time submitters spent waiting for room
+    std::atomic<uint64_t> blockedNanos{0};
+
+private:
+    // The pool and worker the calling thread belongs to; zero, like any
+    // thread_local, on threads outside a pool
+    struct Worker
+    {
+        WorkStealingPool *pool;
+        size_t index;
+    };
+    static inline thread_local Worker current;
+
+    void run(size_t index)
+    {
+        current = {this, index};
+        // Victims are tried round robin from a different start per worker
+        size_t victim = index;
+        while (true)
+        {
+            Task *task = nullptr;
+            if (!deques[index]->pop(task) && !takeInjected(task))
+            {
+                for (size_t i = 1; i < deques.size() && !task; i++)
+                {
+                    victim = (victim + 1) % deques.size();
+                    if (victim != index && deques[victim]->steal(task))
+                        stolen.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (task)
+            {
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                (*task)();
+                delete task;
+                continue;
+            }
+            if (!sleep())
+                return;
+        }
+    }
+
+    bool takeInjected(Task *&task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (injected.empty())
+            return false;
+        task = injected.front();
+        injected.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Waits for a task to turn up. Returns false once the pool is closing
+    // and nothing is left to run.
+    bool sleep()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers.fetch_add(1);
+        // Pairs with the fence in wake(): either that sees this worker asleep,
+        // or this sees the task
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool more = queued.load(std::memory_order_relaxed) > 0;
+        if (!more && closing)
+        {
+            sleepers.fetch_sub(1);
+            return false;
+        }
+        if (!more)
+            idle.wait(lock);
+        sleepers.fetch_sub(1);
+        return true;
+    }
+
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) == 0)
+            return;
+        // Taking the lock, if only for a moment, means a worker between
+        // finding nothing and going to sleep cannot miss the notification
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.notify_one();
+    }
+
+    std::vector<std::unique_ptr<WorkDeque<Task *>>> deques;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::condition_variable notFull;
+    std::deque<Task *> injected;
+    bool closing = false;
+    // Tasks queued anywhere and not yet taken
+    std::atomic<size_t> queued{0};
+    std::atomic<int> sleepers{0};
+};